@@ -1,7 +1,29 @@
 #pragma once
 
+#include <cstdint>
+
 static inline void
 nop_pause()
 {
   __asm__ volatile ("pause" ::);
 }
+
+// reads the time stamp counter. not serializing, so it can be reordered w/
+// the surrounding instructions
+static inline uint64_t
+rdtsc()
+{
+  uint32_t lo, hi;
+  __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return (uint64_t(hi) << 32) | lo;
+}
+
+// reads the time stamp counter once all prior instructions have executed
+// (later ones can still start early)
+static inline uint64_t
+rdtscp()
+{
+  uint32_t lo, hi, aux;
+  __asm__ volatile ("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+  return (uint64_t(hi) << 32) | lo;
+}
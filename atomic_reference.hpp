@@ -4,6 +4,7 @@
 #include <atomic>
 
 #include "asm.hpp"
+#include "lock_profile.hpp"
 
 /**
  * A std::shared_ptr<T>-like abstraction for reference counting,
@@ -97,6 +98,16 @@ public:
   inline bool try_lock() { return true; }
 };
 
+// nothing to profile
+template <typename Site>
+struct site_lock_type<nop_lock, Site> {
+  typedef nop_lock type;
+};
+
+namespace private_ {
+  LOCK_SITE(atomic_ref_ptr_site, "atomic_ref_ptr::mutex_");
+}
+
 // T must inherit atomic_ref_counted (or implement the same interface)
 // this class also supports one-time marking of ptrs.
 //
@@ -104,7 +115,7 @@ public:
 template <typename T, typename LockImpl = spinlock>
 class atomic_ref_ptr : public private_::ptr_ops_mixin<T> {
   typedef typename private_::ptr_ops_mixin<T>::opaque_t opaque_t;
-  typedef LockImpl lock_type;
+  typedef site_lock<LockImpl, private_::atomic_ref_ptr_site> lock_type;
   typedef std::lock_guard<lock_type> lock_guard;
 
 public:
@@ -211,10 +222,34 @@ public:
     return this->IsMarked(get_raw());
   }
 
+  // loads w/ an explicit memory order. neither touches the reference count,
+  // so the returned ptr is only safe to dereference if the pointee is
+  // otherwise kept alive (ie by an RCU region)
+  inline T *
+  get(std::memory_order order) const
+  {
+    return this->Ptr(ptr_.load(order));
+  }
+
+  inline bool
+  get_mark(std::memory_order order) const
+  {
+    return this->IsMarked(ptr_.load(order));
+  }
+
   // returns when this ptr is marked- returns
   // true if the caller was the one responsible for the marking
   inline bool
   mark()
+  {
+    return mark(nop_pause);
+  }
+
+  // same as mark(), except on_failure() is invoked whenever the marking CAS
+  // fails (ie to back off) before retrying
+  template <typename OnFailure>
+  inline bool
+  mark(OnFailure on_failure)
   {
   retry:
     opaque_t this_opaque = get_raw();
@@ -222,7 +257,7 @@ public:
       return false;
     opaque_t new_opaque = this->Mark(this_opaque);
     if (!ptr_.compare_exchange_strong(this_opaque, new_opaque)) {
-      nop_pause();
+      on_failure();
       goto retry;
     }
     assert(get_mark());
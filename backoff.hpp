@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#include "asm.hpp"
+#include "macros.hpp"
+#include "util.hpp"
+
+/**
+ * Backoff policies for optimistic retry loops.
+ *
+ * A backoff object is constructed once per operation (outside of the retry
+ * loop), and fail() is invoked after every failed attempt, before retrying.
+ * fail() decides how long to wait before the next attempt.
+ */
+
+namespace private_ {
+static inline void
+spin_for(unsigned int n)
+{
+  for (unsigned int i = 0; i < n; i++)
+    nop_pause();
+}
+
+// xorshift64, w/ per-thread state
+static inline uint64_t
+thread_random()
+{
+  static __thread uint64_t state = 0;
+  if (unlikely(!state))
+    state = this_thread_hash() | 0x1;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+}
+
+// retry immediately
+class no_backoff {
+public:
+  inline void fail() {}
+};
+
+// spin for a window of pause instructions, which doubles after every failure
+template <unsigned int MinSpins = 4, unsigned int MaxSpins = 1024>
+class exponential_backoff {
+public:
+  exponential_backoff() : limit_(MinSpins) {}
+
+  inline void
+  fail()
+  {
+    private_::spin_for(limit_);
+    limit_ = std::min(limit_ * 2, MaxSpins);
+  }
+
+private:
+  unsigned int limit_;
+};
+
+// spin for a window which grows by Step pause instructions after every
+// failure, ie in proportion to the number of failures so far. Grows more
+// gently than exponential_backoff, which overshoots when contention is short
+template <unsigned int Step = 16, unsigned int MaxSpins = 1024>
+class proportional_backoff {
+public:
+  proportional_backoff() : limit_(Step) {}
+
+  inline void
+  fail()
+  {
+    private_::spin_for(limit_);
+    limit_ = std::min(limit_ + Step, MaxSpins);
+  }
+
+private:
+  unsigned int limit_;
+};
+
+// same as exponential_backoff, except the number of spins is drawn uniformly
+// from [0, window), so that threads which failed together don't all retry
+// together
+template <unsigned int MinSpins = 4, unsigned int MaxSpins = 1024>
+class randomized_backoff {
+public:
+  randomized_backoff() : limit_(MinSpins) {}
+
+  inline void
+  fail()
+  {
+    private_::spin_for(private_::thread_random() % limit_);
+    limit_ = std::min(limit_ * 2, MaxSpins);
+  }
+
+private:
+  unsigned int limit_;
+};
+
+// Adapts the initial window to the failure rate recently seen by the calling
+// thread: a thread whose operations keep failing starts out w/ a large
+// window, and a thread which keeps succeeding retries (almost) immediately.
+//
+// The failure rate is an exponentially weighted moving average of failures
+// per operation, which is updated when the backoff object is destroyed (ie
+// when the operation completes).
+template <unsigned int MinSpins = 4, unsigned int MaxSpins = 1024>
+class adaptive_backoff {
+public:
+  adaptive_backoff()
+    : limit_(std::min(MaxSpins, (tl_fail_rate_ * MinSpins) >> RateShift)),
+      nfailures_(0)
+  {}
+
+  ~adaptive_backoff()
+  {
+    // rate = 7/8 * rate + 1/8 * nfailures, in fixed point
+    tl_fail_rate_ = tl_fail_rate_ - (tl_fail_rate_ >> 3) +
+      (((nfailures_ < MaxTrackedFailures ? nfailures_ : MaxTrackedFailures)
+        << RateShift) >> 3);
+  }
+
+  adaptive_backoff(const adaptive_backoff &) = delete;
+  adaptive_backoff &operator=(const adaptive_backoff &) = delete;
+
+  inline void
+  fail()
+  {
+    private_::spin_for(limit_);
+    limit_ = std::min(std::max(limit_ * 2, MinSpins), MaxSpins);
+    nfailures_++;
+  }
+
+private:
+  static const unsigned int RateShift = 8; // fixed point fractional bits
+  static const unsigned int MaxTrackedFailures = 64;
+
+  unsigned int limit_;
+  unsigned int nfailures_;
+
+  static __thread unsigned int tl_fail_rate_;
+};
+
+template <unsigned int MinSpins, unsigned int MaxSpins>
+__thread unsigned int adaptive_backoff<MinSpins, MaxSpins>::tl_fail_rate_ = 0;
@@ -1,25 +1,133 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <thread>
 #include <string>
 #include <vector>
 #include <set>
+#include <sstream>
 #include <memory>
 
-#include <unistd.h> // for sleep()
+#include <unistd.h> // for usleep()
 #include <getopt.h>
 
 #include "policy.hpp"
 #include "asm.hpp"
+#include "histogram.hpp"
+#include "json_writer.hpp"
+#include "lock_profile.hpp"
+#include "memory_usage.hpp"
+#include "perf_counters.hpp"
 #include "rcu.hpp"
+#include "steady_state.hpp"
 #include "timer.hpp"
+#include "workload.hpp"
+#include "topology.hpp"
 
 using namespace std;
 
 // some global variables - set defaults here
 static int g_verbose = false;
+// how the results are reported (--format): text, or a single JSON object
+// w/ the whole configuration and every metric
+static string g_format = "text";
 static size_t g_nthreads = 1;
 static uint64_t g_duration_sec = 10;
 
+// the operation performed by each reader in the readonly benchmark
+enum readonly_op {
+  READONLY_OP_SIZE,
+  READONLY_OP_ITERATE,
+  READONLY_OP_RAW_ITERATE,
+  READONLY_OP_FOR_EACH,
+};
+static readonly_op g_readonly_op = READONLY_OP_SIZE;
+static string g_readonly_op_name = "size";
+
+static int g_bulk_remove = false;
+
+// number of producers in the queue benchmark (the remaining threads are
+// consumers). defaults to half of the threads
+static size_t g_nproducers = 0;
+static bool g_nproducers_set = false;
+
+// backoff policy for the lock-free policies' retry loops
+static string g_backoff_type = "none";
+
+// the lock exercised by the lock benchmark, or the lock plugged into
+// global_lock (its global lock) and per_node_lock (its tail lock). empty means
+// the default
+static string g_lock_type = "";
+
+// if non-zero, runs this many threads per CPU (overriding --num-threads), to
+// see how the locks hold up when their holders get descheduled
+static size_t g_oversubscribe = 0;
+
+// if non-zero, the latency of one out of every g_latency_sample ops is
+// recorded, and latency percentiles are printed w/ --verbose
+static uint64_t g_latency_sample = 0;
+
+// the ops of the mixed benchmark
+enum mixed_op {
+  MIXED_OP_FRONT,
+  MIXED_OP_BACK,
+  MIXED_OP_ITERATE,
+  MIXED_OP_PUSH_BACK,
+  MIXED_OP_TRY_POP_FRONT,
+  MIXED_OP_REMOVE,
+  NMixedOps,
+};
+static const vector<string> mixed_op_names =
+  {"front", "back", "iterate", "push_back", "try_pop_front", "remove"};
+
+// relative weights of the mixed ops (--mix)
+static string g_mix = "front=20,back=10,iterate=5,push_back=25,try_pop_front=20,remove=20";
+static vector<uint64_t> g_mix_weights;
+
+// keys operated on by the mixed benchmark (--key-dist, --key-range)
+static string g_key_dist = "uniform";
+static uint64_t g_key_range = 1000;
+static unique_ptr<key_distribution> g_keys;
+
+// number of elements the list starts out w/ (--initial-size). 0 means the
+// benchmark's default
+static size_t g_initial_size = 0;
+
+static inline size_t
+initial_size(size_t default_size)
+{
+  return g_initial_size ? g_initial_size : default_size;
+}
+
+// size in bytes of the values of --value-type payload (--value-size)
+static size_t g_value_size = 64;
+
+// CPUs that workers are pinned to: worker i runs on g_pin_cpus[i % size].
+// empty if workers aren't pinned (--pin)
+static string g_pin = "none";
+static vector<unsigned int> g_pin_cpus;
+
+// the CPU the RCU GC thread is pinned to, or -1
+static int g_pin_gc = -1;
+
+// whether every worker counts perf events, which are reported w/ --verbose
+static int g_perf_counters = false;
+
+// how often the workers' progress is sampled during a run
+// (--sample-interval), and where the samples are written to (--timeseries),
+// if anywhere
+static uint64_t g_sample_msec = 100;
+static string g_timeseries_path;
+
+// memory usage is sampled at most this often, whatever the sampling interval,
+// since reading it can lock every malloc arena
+static const uint64_t MemorySampleMsec = 100;
+
+// what the latencies are reported for (the policy, or the lock type of the
+// lock benchmark)
+static string g_latency_label;
+
 static void
 _die(const char *filename,
      const char *func,
@@ -40,91 +148,786 @@ _die(const char *filename,
 class worker {
   friend class benchmark;
 public:
-  worker(const string &name) : name(name), nops(0) {}
+  // op_names are the types of ops whose latency the worker records
+  worker(const string &name, const vector<string> &op_names)
+    : name(name), nops(), op_names(op_names),
+      latencies(op_names.size()), sample_countdown(g_latency_sample) {}
   virtual ~worker() {}
 
+  // workers are allocated on cache lines of their own, so that the state one
+  // updates on every op (its op count, its rng etc) never shares a line w/
+  // another worker's
+  static void *
+  operator new(size_t size)
+  {
+    void *p = nullptr;
+    if (posix_memalign(&p, CACHELINE_SIZE,
+                       (size + CACHELINE_SIZE - 1) & ~(CACHELINE_SIZE - 1)))
+      throw bad_alloc();
+    return p;
+  }
+
+  static void
+  operator delete(void *p)
+  {
+    free(p);
+  }
+
 protected:
 
+  // runs fn, an op of type op_names[op], and records its latency if it is
+  // sampled
+  template <typename Function>
+  inline void
+  timed_op(size_t op, Function fn)
+  {
+    // sample_countdown is 0 iff sampling is off
+    if (likely(!sample_countdown || --sample_countdown)) {
+      fn();
+      return;
+    }
+    sample_countdown = g_latency_sample;
+    const uint64_t t0 = tsc_clock::ticks();
+    fn();
+    latencies[op].record(tsc_clock::ticks() - t0);
+  }
+
   static void
   thread_fn(unique_ptr<worker> &w,
             const atomic<bool> &start_flag,
             const atomic<bool> &stop_flag)
   {
+    // opening the counters is slow, so it is done before the start
+    if (g_perf_counters)
+      w->perf.reset(new perf_counters);
     while (!start_flag.load())
       nop_pause();
+    if (w->perf)
+      w->perf->start();
     w->run(stop_flag);
+    if (w->perf)
+      w->perf->stop();
   }
 
   // returns the number of ops
   virtual void run(const atomic<bool> &stop_flag) = 0;
 
   string name;
-  atomic<size_t> nops;
+  // only updated by the worker itself, and read by the sampling thread
+  single_writer_counter<size_t> nops;
+
+private:
+  vector<string> op_names;
+  vector<latency_histogram> latencies; // in tsc_clock ticks
+  uint64_t sample_countdown;
+  unique_ptr<perf_counters> perf; // null unless --perf-counters
+};
+
+// a snapshot of the workers' progress and of memory usage during a run
+struct run_sample {
+  uint64_t nsec; // since the start of the run
+  uint64_t nops; // over all workers
+  vector<uint64_t> worker_nops;
+  bool has_mem; // mem is only read every MemorySampleMsec
+  memory_usage mem;
+};
+
+// memory usage over the samples taken during a run
+struct memory_samples {
+  memory_samples()
+    : n(0), max_live_bytes(0), sum_rcu_pending(0), max_rcu_pending(0) {}
+
+  void
+  add(const memory_usage &m)
+  {
+    n++;
+    max_live_bytes = max(max_live_bytes, m.live_bytes);
+    sum_rcu_pending += m.rcu_pending;
+    max_rcu_pending = max(max_rcu_pending, m.rcu_pending);
+  }
+
+  uint64_t n;
+  uint64_t max_live_bytes;
+  uint64_t sum_rcu_pending;
+  uint64_t max_rcu_pending;
 };
 
 class benchmark {
 public:
   virtual ~benchmark() {}
 
+  // reports the results as text, or writes them to json if non-null
   void
-  do_bench()
+  do_bench(json_writer *json)
   {
+    const memory_usage mem_before = memory_usage::read();
     init();
+    const memory_usage mem_init = memory_usage::read();
+    const size_t nelems = num_initial_elems();
     auto workers = make_workers();
     atomic<bool> start_flag(false);
     atomic<bool> stop_flag(false);
     vector<thread> thds;
     for (auto &w : workers)
       thds.emplace_back(worker::thread_fn, ref(w), ref(start_flag), ref(stop_flag));
+    // workers wait for start_flag, so they all start out on their CPUs
+    for (size_t i = 0; i < thds.size() && !g_pin_cpus.empty(); i++) {
+      const unsigned int cpu = g_pin_cpus[i % g_pin_cpus.size()];
+      if (!topology::pin(thds[i].native_handle(), cpu))
+        die("could not pin worker to cpu " + to_string(cpu));
+    }
     start_flag.store(true);
     timer t;
-    sleep(g_duration_sec);
+    const vector<run_sample> samples = sample_run(workers, g_duration_sec);
     stop_flag.store(true);
     for (auto &t : thds)
       t.join();
     const uint64_t elasped_usec = t.lap();
+    const memory_usage mem_end = memory_usage::read();
     const double elasped_sec = double(elasped_usec) / 1000000.0;
     size_t agg_ops = 0;
     for (auto &w : workers) {
       if (g_verbose)
-        cout << w->name << " : " << double(w->nops)/elasped_sec << " ops/sec" << endl;
-      agg_ops += w->nops;
+        cout << w->name << " : " << double(w->nops.get())/elasped_sec << " ops/sec" << endl;
+      agg_ops += w->nops.get();
     }
-    if (g_verbose)
-      cout << "total : " << double(agg_ops)/elasped_sec << " ops/sec" << endl;
-    else
+    memory_samples mem_run;
+    for (auto &s : samples)
+      if (s.has_mem)
+        mem_run.add(s.mem);
+
+    // the headline throughput leaves out the warm-up, as detected over the
+    // throughput of every sampling interval
+    const size_t warmup = mser5_warmup(interval_throughputs(samples));
+    const run_sample &steady_begin = samples[warmup];
+    const run_sample &steady_end = samples.back();
+    const double steady_ops_per_sec =
+      steady_end.nsec > steady_begin.nsec ?
+        double(steady_end.nops - steady_begin.nops) * 1e9 /
+          double(steady_end.nsec - steady_begin.nsec) :
+        double(agg_ops)/elasped_sec;
+    if (!g_timeseries_path.empty())
+      write_timeseries(g_timeseries_path, samples, warmup);
+
+    if (json) {
+      json->begin_object();
+      json->field("ops_per_sec", steady_ops_per_sec);
+      json->field("ops_per_sec_incl_warmup", double(agg_ops)/elasped_sec);
+      json->field("warmup_ms", steady_begin.nsec / 1000000);
+      json->field("warmup_intervals", warmup);
+      json->field("intervals", samples.size() - 1);
+      json->field("elapsed_sec", elasped_sec);
+      json->field("total_ops", agg_ops);
+      json->key("workers");
+      json->begin_array();
+      for (auto &w : workers) {
+        const size_t nops = w->nops.get();
+        json->begin_object();
+        json->field("name", w->name);
+        json->field("ops", nops);
+        json->field("ops_per_sec", double(nops)/elasped_sec);
+        json->end_object();
+      }
+      json->end_array();
+      json->key("stats");
+      json->begin_object();
+      write_stats(*json, agg_ops);
+      json->end_object();
+      if (g_latency_sample)
+        write_latencies(*json, workers);
+      if (g_perf_counters)
+        write_perf_counters(*json, workers, agg_ops);
+      write_memory(*json, mem_before, mem_init, nelems, mem_run, mem_end);
+      json->end_object();
+    } else if (g_verbose) {
+      cout << "total : " << steady_ops_per_sec << " ops/sec" << endl
+           << "total incl. warm-up : " << double(agg_ops)/elasped_sec
+           << " ops/sec" << endl
+           << "warm-up : " << steady_begin.nsec / 1000000 << " ms ("
+           << warmup << " of " << samples.size() - 1 << " intervals)" << endl;
+      print_stats(agg_ops);
+      if (g_latency_sample)
+        print_latencies(workers);
+      if (g_perf_counters)
+        print_perf_counters(workers, agg_ops);
+      print_memory(mem_before, mem_init, nelems, mem_run, mem_end);
+    } else {
       // output for runner.py
-      cout << double(agg_ops)/elasped_sec << endl;
+      cout << steady_ops_per_sec << endl;
+    }
     cleanup();
   }
 
 protected:
   virtual void init() = 0;
   virtual void cleanup() = 0;
+
+  static inline uint64_t
+  ticks_to_nsec(uint64_t ticks)
+  {
+    return uint64_t(tsc_clock::to_nsec(ticks));
+  }
+
+  // merges the workers' histograms per op type (in order of appearance)
+  static vector<pair<string, latency_histogram>>
+  merge_latencies(const vector<unique_ptr<worker>> &workers)
+  {
+    vector<pair<string, latency_histogram>> merged;
+    for (auto &w : workers) {
+      for (size_t i = 0; i < w->op_names.size(); i++) {
+        auto it = find_if(merged.begin(), merged.end(),
+            [&w, i](const pair<string, latency_histogram> &p) {
+              return p.first == w->op_names[i];
+            });
+        if (it == merged.end()) {
+          merged.emplace_back(w->op_names[i], latency_histogram());
+          it = merged.end() - 1;
+        }
+        it->second.merge(w->latencies[i]);
+      }
+    }
+    return merged;
+  }
+
+  static void
+  print_latencies(const vector<unique_ptr<worker>> &workers)
+  {
+    for (auto &p : merge_latencies(workers)) {
+      const latency_histogram &h = p.second;
+      cout << "latency " << g_latency_label << " " << p.first << " (ns) :"
+           << " samples=" << h.count()
+           << " p50=" << ticks_to_nsec(h.percentile(0.5))
+           << " p90=" << ticks_to_nsec(h.percentile(0.9))
+           << " p99=" << ticks_to_nsec(h.percentile(0.99))
+           << " p99.9=" << ticks_to_nsec(h.percentile(0.999))
+           << " max=" << ticks_to_nsec(h.max()) << endl;
+    }
+  }
+
+  static void
+  write_latencies(json_writer &json, const vector<unique_ptr<worker>> &workers)
+  {
+    json.key("latencies_ns");
+    json.begin_object();
+    for (auto &p : merge_latencies(workers)) {
+      const latency_histogram &h = p.second;
+      json.key(p.first);
+      json.begin_object();
+      json.field("samples", h.count());
+      json.field("p50", ticks_to_nsec(h.percentile(0.5)));
+      json.field("p90", ticks_to_nsec(h.percentile(0.9)));
+      json.field("p99", ticks_to_nsec(h.percentile(0.99)));
+      json.field("p99.9", ticks_to_nsec(h.percentile(0.999)));
+      json.field("max", ticks_to_nsec(h.max()));
+      json.end_object();
+    }
+    json.end_object();
+  }
+
+  // sums up every event counted by all of the workers. an event is only
+  // had if every worker could count it
+  static void
+  sum_perf_counters(const vector<unique_ptr<worker>> &workers,
+                    uint64_t counts[], bool has[])
+  {
+    for (size_t i = 0; i < perf_counters::NEvents; i++) {
+      const perf_counters::event e = perf_counters::event(i);
+      counts[i] = 0;
+      has[i] = true;
+      for (auto &w : workers) {
+        has[i] = has[i] && w->perf->has(e);
+        counts[i] += w->perf->count(e);
+      }
+    }
+  }
+
+  static void
+  print_perf_counters(const vector<unique_ptr<worker>> &workers,
+                      size_t agg_ops)
+  {
+    uint64_t counts[perf_counters::NEvents];
+    bool has[perf_counters::NEvents];
+    sum_perf_counters(workers, counts, has);
+    bool any_hardware = false;
+    for (size_t i = 0; i < perf_counters::NEvents; i++) {
+      const perf_counters::event e = perf_counters::event(i);
+      any_hardware = any_hardware || (has[i] && perf_counters::is_hardware(e));
+      if (!has[i])
+        continue;
+      cout << "perf " << perf_counters::event_name(e) << " : " << counts[i]
+           << " (" << (agg_ops ? double(counts[i]) / double(agg_ops) : 0.0)
+           << "/op";
+      if (e == perf_counters::INSTRUCTIONS && has[perf_counters::CYCLES] &&
+          counts[perf_counters::CYCLES])
+        cout << ", " << double(counts[i]) / double(counts[perf_counters::CYCLES])
+             << " IPC";
+      cout << ")" << endl;
+    }
+    if (!any_hardware)
+      cout << "perf : no hardware events available, software events only"
+           << endl;
+  }
+
+  // only the events which were had
+  static void
+  write_perf_counters(json_writer &json,
+                      const vector<unique_ptr<worker>> &workers,
+                      size_t agg_ops)
+  {
+    uint64_t counts[perf_counters::NEvents];
+    bool has[perf_counters::NEvents];
+    sum_perf_counters(workers, counts, has);
+    json.key("perf");
+    json.begin_object();
+    for (size_t i = 0; i < perf_counters::NEvents; i++) {
+      if (!has[i])
+        continue;
+      json.key(perf_counters::event_name(perf_counters::event(i)));
+      json.begin_object();
+      json.field("total", counts[i]);
+      json.field("per_op",
+                 agg_ops ? double(counts[i]) / double(agg_ops) : 0.0);
+      json.end_object();
+    }
+    json.end_object();
+  }
+
+  // sleeps for duration_sec while the workers run, taking a sample every
+  // g_sample_msec, as well as right away and at the very end. memory usage is
+  // read w/ the first and the last sample, and at most every MemorySampleMsec
+  // in between
+  static vector<run_sample>
+  sample_run(const vector<unique_ptr<worker>> &workers, uint64_t duration_sec)
+  {
+    vector<run_sample> samples;
+    const uint64_t start_nsec = monotonic_nsec();
+    const uint64_t end_nsec = start_nsec + duration_sec * 1000000000;
+    uint64_t next_mem_nsec = start_nsec;
+    for (uint64_t next_nsec = start_nsec;;) {
+      run_sample s;
+      s.nsec = monotonic_nsec() - start_nsec;
+      s.nops = 0;
+      for (auto &w : workers) {
+        s.worker_nops.push_back(w->nops.get());
+        s.nops += s.worker_nops.back();
+      }
+      const bool last = monotonic_nsec() >= end_nsec;
+      // goes by when the sample was scheduled: the time it was actually taken
+      // at jitters, and would skip every other grid point w/ a 100ms interval
+      s.has_mem = last || next_nsec >= next_mem_nsec;
+      if (s.has_mem) {
+        s.mem = memory_usage::read();
+        const uint64_t mem_nsec = MemorySampleMsec * 1000000;
+        next_mem_nsec =
+          next_nsec + mem_nsec - (next_nsec - start_nsec) % mem_nsec;
+      }
+      samples.push_back(move(s));
+      if (last)
+        break;
+
+      const uint64_t now_nsec = monotonic_nsec();
+      // on a fixed schedule, so that the time spent sampling doesn't add up
+      next_nsec = min(max(next_nsec + g_sample_msec * 1000000, now_nsec),
+                      end_nsec);
+      usleep((next_nsec - now_nsec) / 1000);
+    }
+    return samples;
+  }
+
+  // ops/sec over all workers, for every interval between two samples
+  static vector<double>
+  interval_throughputs(const vector<run_sample> &samples)
+  {
+    vector<double> ret;
+    for (size_t i = 1; i < samples.size(); i++) {
+      const uint64_t nsec = samples[i].nsec - samples[i - 1].nsec;
+      ret.push_back(nsec ?
+          double(samples[i].nops - samples[i - 1].nops) * 1e9 / nsec : 0.0);
+    }
+    return ret;
+  }
+
+  // one row per sampling interval, as JSON if path ends in .json, or as CSV
+  // otherwise. steady is 0 for the intervals of the warm-up
+  static void
+  write_timeseries(const string &path, const vector<run_sample> &samples,
+                   size_t warmup)
+  {
+    ofstream out(path.c_str());
+    if (!out)
+      die("could not open " + path);
+    const bool json =
+      path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json)
+      write_timeseries_json(out, samples, warmup);
+    else
+      write_timeseries_csv(out, samples, warmup);
+  }
+
+  // worker w's ops/sec over the interval between prev and cur
+  static double
+  worker_interval_throughput(const run_sample &prev, const run_sample &cur,
+                             size_t w)
+  {
+    const uint64_t nsec = cur.nsec - prev.nsec;
+    return nsec ?
+      double(cur.worker_nops[w] - prev.worker_nops[w]) * 1e9 / nsec : 0.0;
+  }
+
+  static void
+  write_timeseries_csv(ostream &out, const vector<run_sample> &samples,
+                       size_t warmup)
+  {
+    const size_t nworkers = samples[0].worker_nops.size();
+    const vector<double> rates = interval_throughputs(samples);
+    out << "t_ms,steady,ops_per_sec";
+    for (size_t w = 0; w < nworkers; w++)
+      out << ",worker" << w << "_ops_per_sec";
+    out << ",live_bytes,rss_bytes,rcu_pending" << endl;
+    for (size_t i = 1; i < samples.size(); i++) {
+      const run_sample &prev = samples[i - 1], &cur = samples[i];
+      out << cur.nsec / 1000000 << "," << (i > warmup) << "," << rates[i - 1];
+      for (size_t w = 0; w < nworkers; w++)
+        out << "," << worker_interval_throughput(prev, cur, w);
+      // intervals w/o a memory sample leave its cells empty
+      if (cur.has_mem)
+        out << "," << cur.mem.live_bytes << "," << cur.mem.rss_bytes << ","
+            << cur.mem.rcu_pending << endl;
+      else
+        out << ",,," << endl;
+    }
+  }
+
+  static void
+  write_timeseries_json(ostream &out, const vector<run_sample> &samples,
+                        size_t warmup)
+  {
+    const size_t nworkers = samples[0].worker_nops.size();
+    const vector<double> rates = interval_throughputs(samples);
+    json_writer json(out);
+    json.begin_object();
+    json.field("interval_ms", g_sample_msec);
+    json.field("warmup_ms", samples[warmup].nsec / 1000000);
+    json.key("samples");
+    json.begin_array();
+    for (size_t i = 1; i < samples.size(); i++) {
+      const run_sample &prev = samples[i - 1], &cur = samples[i];
+      json.begin_object();
+      json.field("t_ms", cur.nsec / 1000000);
+      json.field("steady", i > warmup);
+      json.field("ops_per_sec", rates[i - 1]);
+      json.key("worker_ops_per_sec");
+      json.begin_array();
+      for (size_t w = 0; w < nworkers; w++)
+        json.value(worker_interval_throughput(prev, cur, w));
+      json.end_array();
+      // intervals w/o a memory sample leave it out
+      if (cur.has_mem) {
+        json.field("live_bytes", cur.mem.live_bytes);
+        json.field("rss_bytes", cur.mem.rss_bytes);
+        json.field("rcu_pending", cur.mem.rcu_pending);
+      }
+      json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+    out << endl;
+  }
+
+  static void
+  print_memory(const memory_usage &before, const memory_usage &init,
+               size_t nelems, const memory_samples &run,
+               const memory_usage &end)
+  {
+    cout << "memory allocator : " << memory_usage::allocator_name() << endl;
+    if (memory_usage::has_live_bytes()) {
+      const uint64_t peak =
+        max(max(init.live_bytes, run.max_live_bytes), end.live_bytes);
+      cout << "memory live : " << before.live_bytes << " bytes before init, "
+           << init.live_bytes << " after init";
+      // what the initial elements cost, incl. any per-node locks and
+      // reference counts
+      if (nelems && init.live_bytes > before.live_bytes)
+        cout << " ("
+             << double(init.live_bytes - before.live_bytes) / double(nelems)
+             << " bytes/elem)";
+      cout << ", " << peak << " peak, " << end.live_bytes << " at end" << endl;
+    }
+    if (end.active_bytes || end.mapped_bytes)
+      cout << "memory allocator : " << end.active_bytes << " bytes active, "
+           << end.mapped_bytes << " mapped" << endl;
+    cout << "memory rss : " << end.rss_bytes << " bytes at end, "
+         << end.peak_rss_bytes << " peak" << endl
+         << "memory rcu-pending : "
+         << (run.n ? double(run.sum_rcu_pending) / double(run.n) : 0.0)
+         << " mean, " << run.max_rcu_pending << " max, "
+         << end.rcu_pending << " at end (" << run.n << " samples)" << endl;
+  }
+
+  // the same as print_memory(), but live_bytes_* are left out if the
+  // allocator can't tell
+  static void
+  write_memory(json_writer &json, const memory_usage &before,
+               const memory_usage &init, size_t nelems,
+               const memory_samples &run, const memory_usage &end)
+  {
+    json.key("memory");
+    json.begin_object();
+    json.field("allocator", memory_usage::allocator_name());
+    json.field("initial_elems", nelems);
+    if (memory_usage::has_live_bytes()) {
+      json.field("live_bytes_before_init", before.live_bytes);
+      json.field("live_bytes_after_init", init.live_bytes);
+      if (nelems && init.live_bytes > before.live_bytes)
+        json.field("bytes_per_elem",
+                   double(init.live_bytes - before.live_bytes) /
+                     double(nelems));
+      json.field("live_bytes_peak",
+                 max(max(init.live_bytes, run.max_live_bytes),
+                     end.live_bytes));
+      json.field("live_bytes_end", end.live_bytes);
+    }
+    if (end.active_bytes || end.mapped_bytes) {
+      json.field("active_bytes", end.active_bytes);
+      json.field("mapped_bytes", end.mapped_bytes);
+    }
+    json.field("rss_bytes", end.rss_bytes);
+    json.field("peak_rss_bytes", end.peak_rss_bytes);
+    json.field("rcu_pending_mean",
+               run.n ? double(run.sum_rcu_pending) / double(run.n) : 0.0);
+    json.field("rcu_pending_max", run.max_rcu_pending);
+    json.field("rcu_pending_end", end.rcu_pending);
+    json.end_object();
+  }
+
   virtual vector<unique_ptr<worker>> make_workers() = 0;
+
+  // the number of elements init() set up, if any
+  virtual size_t num_initial_elems() { return 0; }
+
+  // implementation specific statistics, printed w/ --verbose, or written
+  // w/ --format json
+  virtual void print_stats(size_t agg_ops) {}
+  virtual void write_stats(json_writer &json, size_t agg_ops) {}
 };
 
+// prints (or writes) the retry counters of implementations which have them
 template <typename Impl>
-class read_only_benchmark : public benchmark {
-  typedef linked_list<int, Impl> llist;
-  static const size_t NElems = 100;
+class impl_stats {
+  template <typename U>
+  static void
+  print(const U &impl, size_t agg_ops, typename U::retry_site *)
+  {
+    for (size_t i = 0; i < U::NRetrySites; i++) {
+      const typename U::retry_site site = typename U::retry_site(i);
+      const uint64_t n = impl.retry_count(site);
+      cout << "retries " << U::retry_site_name(site) << " : " << n
+           << " (" << (agg_ops ? double(n)/double(agg_ops) : 0.0) << "/op)"
+           << endl;
+    }
+  }
+
+  template <typename U>
+  static void
+  print(const U &impl, size_t agg_ops, ...)
+  {
+  }
+
+  template <typename U>
+  static void
+  write(json_writer &json, const U &impl, typename U::retry_site *)
+  {
+    json.key("retries");
+    json.begin_object();
+    for (size_t i = 0; i < U::NRetrySites; i++) {
+      const typename U::retry_site site = typename U::retry_site(i);
+      json.field(U::retry_site_name(site), impl.retry_count(site));
+    }
+    json.end_object();
+  }
+
+  template <typename U>
+  static void
+  write(json_writer &json, const U &impl, ...)
+  {
+  }
+
+public:
+  static void
+  print(const Impl &impl, size_t agg_ops)
+  {
+    print<Impl>(impl, agg_ops, nullptr);
+  }
+
+  static void
+  write(json_writer &json, const Impl &impl)
+  {
+    write<Impl>(json, impl, nullptr);
+  }
+};
+
+// common base for the benchmarks which operate on a single list
+template <typename T, typename Impl>
+class list_benchmark : public benchmark {
+protected:
+  typedef linked_list<T, Impl> llist;
+
+  void
+  cleanup() OVERRIDE
+  {
+    list.clear();
+  }
+
+  size_t
+  num_initial_elems() OVERRIDE
+  {
+    return list.size();
+  }
+
+  void
+  print_stats(size_t agg_ops) OVERRIDE
+  {
+    impl_stats<Impl>::print(list.impl(), agg_ops);
+  }
+
+  void
+  write_stats(json_writer &json, size_t agg_ops) OVERRIDE
+  {
+    impl_stats<Impl>::write(json, list.impl());
+  }
+
+  llist list;
+};
+
+// benchmark values are generated from an integer key, so that every benchmark
+// can be run over each of the supported value types
+template <typename T>
+struct value_factory {};
+
+template <>
+struct value_factory<int> {
+  static inline int
+  make(size_t key)
+  {
+    return int(key);
+  }
+};
+
+template <>
+struct value_factory<string> {
+  // long enough to defeat the small string optimization, so that every value
+  // owns a heap allocation (which is what makes copies expensive)
+  static const size_t NChars = 64;
+
+  static inline string
+  make(size_t key)
+  {
+    string s(to_string(key));
+    s.resize(NChars, 'x');
+    return s;
+  }
+};
+
+template <size_t Size>
+struct value_factory<payload<Size>> {
+  static_assert(sizeof(payload<Size>) == Size, "payload is padded");
+
+  static inline payload<Size>
+  make(size_t key)
+  {
+    return payload<Size>(key);
+  }
+};
+
+// detects Impl::supports_raw_iteration (false if Impl doesn't declare it)
+template <typename Impl>
+struct raw_iteration_traits {
+  template <typename U>
+  static constexpr bool
+  check(decltype(&U::supports_raw_iteration))
+  {
+    return U::supports_raw_iteration;
+  }
+
+  template <typename U>
+  static constexpr bool
+  check(...)
+  {
+    return false;
+  }
+
+  static const bool value = check<Impl>(nullptr);
+};
+
+template <typename T, typename Impl,
+          bool Supported = raw_iteration_traits<Impl>::value>
+struct raw_iterate_op {
+  static size_t
+  run(linked_list<T, Impl> *list)
+  {
+    die("policy does not support raw iteration");
+  }
+};
+
+template <typename T, typename Impl>
+struct raw_iterate_op<T, Impl, true> {
+  static size_t
+  run(linked_list<T, Impl> *list)
+  {
+    // one read region covers the entire traversal
+    typename Impl::read_region region UNUSED;
+    size_t n = 0;
+    for (auto it = list->raw_begin(); it != list->raw_end(); ++it)
+      n++;
+    return n;
+  }
+};
+
+template <typename T, typename Impl>
+class read_only_benchmark : public list_benchmark<T, Impl> {
+  typedef typename list_benchmark<T, Impl>::llist llist;
+  static const size_t DefaultNElems = 100;
 
   class ro_worker : public worker {
   public:
-    ro_worker(llist *list) : worker("reader"), list(list), nelems_seen(0) {}
+    ro_worker(llist *list, const string &op_name)
+      : worker("reader", {op_name}), list(list), nelems_seen(0) {}
     inline size_t get_nelems_seen() const { return nelems_seen; }
   protected:
     void
     run(const atomic<bool> &stop_flag) OVERRIDE
     {
       while (!stop_flag.load()) {
-        //vector<int> l(list->begin(), list->end());
-        //nelems_seen += l.size(); // so GCC doesn't optimize the vector away
-        nelems_seen += list->size();
-        nops++;
+        timed_op(0, [this]() { read_op(); });
+        nops.inc();
       }
     }
   private:
+    inline void
+    read_op()
+    {
+      switch (g_readonly_op) {
+      case READONLY_OP_SIZE:
+        nelems_seen += list->size();
+        break;
+      case READONLY_OP_ITERATE:
+        // nelems_seen is reported, so GCC can't optimize the loop away
+        for (auto it = list->begin(); it != list->end(); ++it)
+          nelems_seen++;
+        break;
+      case READONLY_OP_RAW_ITERATE:
+        nelems_seen += raw_iterate_op<T, Impl>::run(list);
+        break;
+      case READONLY_OP_FOR_EACH:
+        {
+          size_t n = 0;
+          list->for_each([&n](const T &) { n++; });
+          nelems_seen += n;
+        }
+        break;
+      }
+    }
+
     llist *list;
     size_t nelems_seen;
   };
@@ -133,14 +936,9 @@ protected:
   void
   init() OVERRIDE
   {
-    for (size_t i = 0; i < NElems; i++)
-      list.push_back(i);
-  }
-
-  void
-  cleanup() OVERRIDE
-  {
-    list.clear();
+    const size_t nelems = initial_size(DefaultNElems);
+    for (size_t i = 0; i < nelems; i++)
+      this->list.push_back(value_factory<T>::make(i));
   }
 
   vector<unique_ptr<worker>>
@@ -148,29 +946,27 @@ protected:
   {
     vector<unique_ptr<worker>> ret;
     for (size_t i = 0; i < g_nthreads; i++)
-      ret.emplace_back(new ro_worker(&list));
-    return move(ret);
+      ret.emplace_back(new ro_worker(&this->list, g_readonly_op_name));
+    return ret;
   }
-
-private:
-  llist list;
 };
 
-template <typename Impl>
-class queue_benchmark : public benchmark {
-  typedef linked_list<int, Impl> llist;
-  static const size_t NElemsInitial = 100000;
+template <typename T, typename Impl>
+class queue_benchmark : public list_benchmark<T, Impl> {
+  typedef typename list_benchmark<T, Impl>::llist llist;
+  static const size_t DefaultNElemsInitial = 100000;
 
   class producer : public worker {
   public:
-    producer(llist *list) : worker("producer"), list(list) {}
+    producer(llist *list) : worker("producer", {"push_back"}), list(list) {}
   protected:
     void
     run(const atomic<bool> &stop_flag) OVERRIDE
     {
-      while (!stop_flag.load()) {
-        list->push_back(1);
-        nops++;
+      for (size_t i = 0; !stop_flag.load(); i++) {
+        T v = value_factory<T>::make(i);
+        timed_op(0, [this, &v]() { list->push_back(std::move(v)); });
+        nops.inc();
       }
     }
   private:
@@ -179,17 +975,20 @@ class queue_benchmark : public benchmark {
 
   class consumer : public worker {
   public:
-    consumer(llist *list) : worker("consumer"), list(list), nelems_popped(0) {}
+    consumer(llist *list)
+      : worker("consumer", {"try_pop_front"}), list(list), nelems_popped(0) {}
     inline size_t get_nelems_popped() const { return nelems_popped; }
   protected:
     void
     run(const atomic<bool> &stop_flag) OVERRIDE
     {
       while (!stop_flag.load()) {
-        auto ret = list->try_pop_front();
-        if (ret.first)
-          nelems_popped++;
-        nops++; // count regardless of removal or not
+        timed_op(0, [this]() {
+          auto ret = list->try_pop_front();
+          if (ret.first)
+            nelems_popped++;
+        });
+        nops.inc(); // count regardless of removal or not
       }
     }
   private:
@@ -201,31 +1000,548 @@ protected:
   void
   init() OVERRIDE
   {
-    for (size_t i = 0; i < NElemsInitial; i++)
-      list.push_back(i);
+    const size_t nelems = initial_size(DefaultNElemsInitial);
+    for (size_t i = 0; i < nelems; i++)
+      this->list.push_back(value_factory<T>::make(i));
+  }
+
+  vector<unique_ptr<worker>>
+  make_workers() OVERRIDE
+  {
+    vector<unique_ptr<worker>> ret;
+    for (size_t i = 0; i < g_nproducers; i++)
+      ret.emplace_back(new producer(&this->list));
+    for (size_t i = g_nproducers; i < g_nthreads; i++)
+      ret.emplace_back(new consumer(&this->list));
+    return ret;
+  }
+};
+
+// Each worker repeatedly inserts a batch of keys which it owns, and then
+// removes them again- either one key at a time w/ remove(), or all at once w/
+// remove_all() (--bulk-remove). The list also holds the initial keys, which
+// are never removed, so that every traversal has to do some work.
+template <typename T, typename Impl>
+class remove_benchmark : public list_benchmark<T, Impl> {
+  typedef typename list_benchmark<T, Impl>::llist llist;
+  static const size_t DefaultNElemsInitial = 1000;
+  static const size_t NElemsPerBatch = 64;
+
+  class remover : public worker {
+  public:
+    remover(llist *list, size_t first_key)
+      : worker("remover",
+               {"push_back", g_bulk_remove ? "remove_all" : "remove"}),
+        list(list), keys()
+    {
+      for (size_t i = 0; i < NElemsPerBatch; i++)
+        keys.push_back(value_factory<T>::make(first_key + i));
+      sort(keys.begin(), keys.end()); // required by remove_all()
+    }
+  protected:
+    void
+    run(const atomic<bool> &stop_flag) OVERRIDE
+    {
+      while (!stop_flag.load()) {
+        for (auto &k : keys)
+          timed_op(0, [this, &k]() { list->push_back(k); });
+        if (g_bulk_remove) {
+          timed_op(1, [this]() { list->remove_all(keys.begin(), keys.end()); });
+        } else {
+          for (auto &k : keys)
+            timed_op(1, [this, &k]() { list->remove(k); });
+        }
+        nops.inc(keys.size()); // one op per removed element
+      }
+    }
+  private:
+    llist *list;
+    vector<T> keys;
+  };
+
+protected:
+  void
+  init() OVERRIDE
+  {
+    for (size_t i = 0; i < initial_size(DefaultNElemsInitial); i++)
+      this->list.push_back(value_factory<T>::make(i));
+  }
+
+  vector<unique_ptr<worker>>
+  make_workers() OVERRIDE
+  {
+    vector<unique_ptr<worker>> ret;
+    // keys past the initial ones, so that they are never removed
+    const size_t first_key = initial_size(DefaultNElemsInitial);
+    for (size_t i = 0; i < g_nthreads; i++)
+      ret.emplace_back(
+          new remover(&this->list, first_key + i * NElemsPerBatch));
+    return ret;
+  }
+};
+
+// Every worker performs a random mix of ops (weighted by --mix), on keys
+// drawn from --key-dist.
+//
+// front() and back() require a non-empty list, so the list is never allowed
+// to drain: every worker starts out w/ a share of the initial elements as a
+// budget, earns one unit per push_back(), and spends one per try_pop_front()
+// or per remove() which found a match (it removes at most the first one),
+// skipping the op if it has no budget left. A remove() which misses costs
+// nothing, otherwise the list would grow throughout the run. The budgets add
+// up to less than the size of the list, and are thread-local, so they cost
+// nothing in the hot path.
+template <typename T, typename Impl>
+class mixed_benchmark : public list_benchmark<T, Impl> {
+  typedef typename list_benchmark<T, Impl>::llist llist;
+  static const size_t DefaultNElemsInitial = 1000;
+
+  class mixer : public worker {
+  public:
+    mixer(llist *list, const vector<uint32_t> *thresholds, uint64_t seed,
+          size_t budget)
+      : worker("mixer", mixed_op_names), list(list), thresholds(thresholds),
+        keys(*g_keys), rng(seed), budget(budget), nseen(0) {}
+    inline size_t get_nseen() const { return nseen; }
+  protected:
+    void
+    run(const atomic<bool> &stop_flag) OVERRIDE
+    {
+      while (!stop_flag.load()) {
+        const size_t op = pick_op();
+        timed_op(op, [this, op]() { do_op(op); });
+        nops.inc();
+      }
+    }
+  private:
+    inline size_t
+    pick_op()
+    {
+      const uint32_t r = rng.next32();
+      size_t op = 0;
+      while (op < NMixedOps - 1 && r >= (*thresholds)[op])
+        op++;
+      return op;
+    }
+
+    inline void
+    do_op(size_t op)
+    {
+      switch (op) {
+      case MIXED_OP_FRONT:
+        // don't read the value, which can be removed concurrently
+        nseen += &list->front() != nullptr;
+        break;
+      case MIXED_OP_BACK:
+        nseen += &list->back() != nullptr;
+        break;
+      case MIXED_OP_ITERATE:
+        for (auto it = list->begin(); it != list->end(); ++it)
+          nseen++;
+        break;
+      case MIXED_OP_PUSH_BACK:
+        list->push_back(value_factory<T>::make(keys.next(rng)));
+        budget++;
+        break;
+      case MIXED_OP_TRY_POP_FRONT:
+        if (budget) {
+          budget--;
+          list->try_pop_front();
+        }
+        break;
+      case MIXED_OP_REMOVE:
+        if (budget) {
+          const T k = value_factory<T>::make(keys.next(rng));
+          bool found = false;
+          list->remove_if([&k, &found](const T &v) {
+            if (found || !(v == k))
+              return false;
+            found = true;
+            return true;
+          });
+          if (found)
+            budget--;
+        }
+        break;
+      }
+    }
+
+    llist *list;
+    const vector<uint32_t> *thresholds;
+    const key_distribution &keys;
+    fast_random rng;
+    size_t budget;
+    size_t nseen;
+  };
+
+protected:
+  void
+  init() OVERRIDE
+  {
+    // cumulative weights, scaled to [0, 2^32)
+    uint64_t total = 0;
+    for (uint64_t w : g_mix_weights)
+      total += w;
+    uint64_t sum = 0;
+    thresholds.clear();
+    for (uint64_t w : g_mix_weights) {
+      sum += w;
+      thresholds.push_back(uint32_t((sum * 0xffffffffULL) / total));
+    }
+
+    fast_random rng(1);
+    for (size_t i = 0; i < initial_size(DefaultNElemsInitial); i++)
+      this->list.push_back(value_factory<T>::make(g_keys->next(rng)));
+  }
+
+  vector<unique_ptr<worker>>
+  make_workers() OVERRIDE
+  {
+    vector<unique_ptr<worker>> ret;
+    // one element is never spent, so that the list is never empty
+    const size_t budget =
+      (initial_size(DefaultNElemsInitial) - 1) / g_nthreads;
+    for (size_t i = 0; i < g_nthreads; i++)
+      ret.emplace_back(
+          new mixer(&this->list, &thresholds, 0x9e3779b97f4a7c15ULL * (i + 2),
+                    budget));
+    return ret;
+  }
+
+private:
+  vector<uint32_t> thresholds;
+};
+
+// Every worker repeatedly acquires a single lock, and increments a counter
+// which the lock protects. Measures throughput, and the latency of handing
+// the lock over between threads: the holder records the TSC right before
+// releasing the lock, and an acquirer which isn't the previous holder
+// computes the time since then (this assumes TSCs are synchronized across
+// cores, which holds for invariant TSCs). Handoffs between threads running on
+// different NUMA nodes are counted separately, since those are the ones which
+// move the protected data across sockets.
+template <typename LockImpl>
+class lock_benchmark : public benchmark {
+
+  // the lock, and the data it protects
+  struct shared_state {
+    shared_state()
+      : lock(), counter(0), owner(-1), owner_node(0), release_tsc(0) {}
+    LockImpl lock;
+    uint64_t counter;
+    ssize_t owner;
+    unsigned int owner_node;
+    uint64_t release_tsc;
+  };
+
+  class locker : public worker {
+  public:
+    locker(shared_state *state, ssize_t id)
+      : worker("locker", {"lock"}), state(state), id(id),
+        nhandoffs(0), ncross_node_handoffs(0), handoff_cycles(0) {}
+    inline uint64_t get_nhandoffs() const { return nhandoffs; }
+    inline uint64_t get_ncross_node_handoffs() const { return ncross_node_handoffs; }
+    inline uint64_t get_handoff_cycles() const { return handoff_cycles; }
+  protected:
+    void
+    run(const atomic<bool> &stop_flag) OVERRIDE
+    {
+      while (!stop_flag.load()) {
+        // looked up outside of the critical section
+        const unsigned int node = topology::current_node();
+        // the latency of an op covers acquiring the lock, the critical
+        // section, and releasing the lock
+        timed_op(0, [this, node]() { critical_section(node); });
+        nops.inc();
+      }
+    }
+  private:
+    inline void
+    critical_section(unsigned int node)
+    {
+      state->lock.lock();
+      const uint64_t now = rdtsc();
+      if (state->owner != id && state->owner != -1) {
+        nhandoffs++;
+        if (state->owner_node != node)
+          ncross_node_handoffs++;
+        handoff_cycles += now - state->release_tsc;
+      }
+      state->counter++;
+      state->owner = id;
+      state->owner_node = node;
+      state->release_tsc = rdtsc();
+      state->lock.unlock();
+    }
+
+    shared_state *state;
+    ssize_t id;
+    uint64_t nhandoffs;
+    uint64_t ncross_node_handoffs;
+    uint64_t handoff_cycles;
+  };
+
+protected:
+  void
+  init() OVERRIDE
+  {
   }
 
   void
   cleanup() OVERRIDE
   {
-    list.clear();
   }
 
   vector<unique_ptr<worker>>
   make_workers() OVERRIDE
   {
     vector<unique_ptr<worker>> ret;
-    for (size_t i = 0; i < g_nthreads / 2; i++)
-      ret.emplace_back(new producer(&list));
-    for (size_t i = g_nthreads / 2; i < g_nthreads; i++)
-      ret.emplace_back(new consumer(&list));
-    return move(ret);
+    for (size_t i = 0; i < g_nthreads; i++) {
+      locker *l = new locker(&state, i);
+      lockers.push_back(l);
+      ret.emplace_back(l);
+    }
+    return ret;
+  }
+
+  void
+  print_stats(size_t agg_ops) OVERRIDE
+  {
+    uint64_t nhandoffs, ncross_node_handoffs, handoff_cycles;
+    sum_handoffs(agg_ops, nhandoffs, ncross_node_handoffs, handoff_cycles);
+    cout << "handoffs : " << nhandoffs
+         << " (" << (agg_ops ? double(nhandoffs)/double(agg_ops) : 0.0)
+         << "/op)" << endl
+         << "cross-node handoffs : " << ncross_node_handoffs
+         << " (" << topology::num_nodes() << " nodes)" << endl
+         << "avg handoff latency : "
+         << (nhandoffs ? double(handoff_cycles)/double(nhandoffs) : 0.0)
+         << " cycles" << endl;
+  }
+
+  void
+  write_stats(json_writer &json, size_t agg_ops) OVERRIDE
+  {
+    uint64_t nhandoffs, ncross_node_handoffs, handoff_cycles;
+    sum_handoffs(agg_ops, nhandoffs, ncross_node_handoffs, handoff_cycles);
+    json.field("handoffs", nhandoffs);
+    json.field("cross_node_handoffs", ncross_node_handoffs);
+    json.field("nodes", topology::num_nodes());
+    json.field("avg_handoff_cycles",
+               nhandoffs ? double(handoff_cycles)/double(nhandoffs) : 0.0);
   }
 
 private:
-  llist list;
+  // over all lockers, after checking that the lock provided mutual exclusion
+  void
+  sum_handoffs(size_t agg_ops, uint64_t &nhandoffs,
+               uint64_t &ncross_node_handoffs, uint64_t &handoff_cycles)
+  {
+    if (state.counter != agg_ops)
+      die("lock failed to provide mutual exclusion");
+    nhandoffs = ncross_node_handoffs = handoff_cycles = 0;
+    for (auto l : lockers) {
+      nhandoffs += l->get_nhandoffs();
+      ncross_node_handoffs += l->get_ncross_node_handoffs();
+      handoff_cycles += l->get_handoff_cycles();
+    }
+  }
+
+  shared_state state;
+  vector<locker *> lockers; // owned by the benchmark driver
+};
+
+// Maker::make<LockImpl>() instantiates a benchmark for LockImpl
+template <typename Maker>
+static benchmark *
+make_locked_benchmark(const string &lock_type)
+{
+  if (lock_type == "tas")
+    return Maker::template make<tas_spinlock>();
+  else if (lock_type == "ttas")
+    return Maker::template make<ttas_spinlock<>>();
+  else if (lock_type == "ttas-exp")
+    return Maker::template make<ttas_spinlock<exponential_backoff<>>>();
+  else if (lock_type == "ttas-prop")
+    return Maker::template make<ttas_spinlock<proportional_backoff<>>>();
+  else if (lock_type == "mutex")
+    return Maker::template make<mutex>();
+  else if (lock_type == "mcs")
+    return Maker::template make<mcs_lock>();
+  else if (lock_type == "clh")
+    return Maker::template make<clh_lock>();
+  else if (lock_type == "hybrid")
+    return Maker::template make<hybrid_lock<>>();
+  else if (lock_type == "cohort")
+    return Maker::template make<cohort_lock<>>();
+  return nullptr;
+}
+
+struct lock_benchmark_maker {
+  template <typename LockImpl>
+  static benchmark *
+  make()
+  {
+    return new lock_benchmark<LockImpl>;
+  }
+};
+
+template <template <typename, typename> class Benchmark, typename T>
+struct global_lock_benchmark_maker {
+  template <typename LockImpl>
+  static benchmark *
+  make()
+  {
+    return new Benchmark<
+      T, typename ll_policy<T>::template with_lock<LockImpl>::global_lock>;
+  }
 };
 
+template <template <typename, typename> class Benchmark, typename T>
+struct per_node_lock_benchmark_maker {
+  template <typename LockImpl>
+  static benchmark *
+  make()
+  {
+    return new Benchmark<
+      T, typename ll_policy<T>::template with_lock<LockImpl>::per_node_lock>;
+  }
+};
+
+template <template <typename, typename> class Benchmark,
+          typename T, typename BackoffImpl>
+static benchmark *
+make_lock_free_benchmark(const string &policy_type)
+{
+  typedef typename ll_policy<T>::template with_backoff<BackoffImpl> policy;
+  if (policy_type == "lock_free")
+    return new Benchmark<T, typename policy::lock_free>;
+  else if (policy_type == "lock_free_rcu")
+    return new Benchmark<T, typename policy::lock_free_rcu>;
+  return nullptr;
+}
+
+template <template <typename, typename> class Benchmark, typename T>
+static benchmark *
+make_policy_benchmark(const string &policy_type)
+{
+  typedef ll_policy<T> policy;
+  if (policy_type == "global_lock" && !g_lock_type.empty())
+    return make_locked_benchmark<
+      global_lock_benchmark_maker<Benchmark, T>>(g_lock_type);
+  else if (policy_type == "per_node_lock" && !g_lock_type.empty())
+    return make_locked_benchmark<
+      per_node_lock_benchmark_maker<Benchmark, T>>(g_lock_type);
+  else if (policy_type == "global_lock")
+    return new Benchmark<T, typename policy::global_lock>;
+  else if (policy_type == "global_rwlock")
+    return new Benchmark<T, typename policy::global_rwlock>;
+  else if (policy_type == "global_seqlock")
+    return new Benchmark<T, typename policy::global_seqlock>;
+  else if (policy_type == "per_node_lock")
+    return new Benchmark<T, typename policy::per_node_lock>;
+  else if (policy_type == "lazy")
+    return new Benchmark<T, typename policy::lazy>;
+  else if (policy_type == "two_lock_queue")
+    return new Benchmark<T, typename policy::two_lock_queue>;
+  else if (policy_type == "null")
+    return new Benchmark<T, typename policy::null>;
+  else if (g_backoff_type == "none")
+    return make_lock_free_benchmark<Benchmark, T, no_backoff>(policy_type);
+  else if (g_backoff_type == "exp")
+    return make_lock_free_benchmark<Benchmark, T, exponential_backoff<>>(policy_type);
+  else if (g_backoff_type == "rand")
+    return make_lock_free_benchmark<Benchmark, T, randomized_backoff<>>(policy_type);
+  else if (g_backoff_type == "adaptive")
+    return make_lock_free_benchmark<Benchmark, T, adaptive_backoff<>>(policy_type);
+  return nullptr;
+}
+
+template <typename T>
+static benchmark *
+make_value_benchmark(const string &bench_type, const string &policy_type)
+{
+  if (bench_type == "readonly")
+    return make_policy_benchmark<read_only_benchmark, T>(policy_type);
+  else if (bench_type == "queue")
+    return make_policy_benchmark<queue_benchmark, T>(policy_type);
+  else if (bench_type == "remove")
+    return make_policy_benchmark<remove_benchmark, T>(policy_type);
+  else if (bench_type == "mixed")
+    return make_policy_benchmark<mixed_benchmark, T>(policy_type);
+  return nullptr;
+}
+
+static benchmark *
+make_payload_benchmark(const string &bench_type, const string &policy_type)
+{
+  switch (g_value_size) {
+  case 64:
+    return make_value_benchmark<payload<64>>(bench_type, policy_type);
+  case 256:
+    return make_value_benchmark<payload<256>>(bench_type, policy_type);
+  case 1024:
+    return make_value_benchmark<payload<1024>>(bench_type, policy_type);
+  }
+  return nullptr;
+}
+
+// parses --mix, eg "front=1,push_back=2" (unlisted ops get no weight)
+static void
+parse_mix(const string &mix)
+{
+  g_mix_weights.assign(NMixedOps, 0);
+  uint64_t total = 0;
+  istringstream in(mix);
+  string entry;
+  while (getline(in, entry, ',')) {
+    const size_t eq = entry.find('=');
+    if (eq == string::npos)
+      die("invalid --mix entry: " + entry);
+    auto it = find(mixed_op_names.begin(), mixed_op_names.end(),
+                   entry.substr(0, eq));
+    if (it == mixed_op_names.end())
+      die("invalid --mix op: " + entry.substr(0, eq));
+    const uint64_t w = strtoull(entry.c_str() + eq + 1, NULL, 10);
+    g_mix_weights[it - mixed_op_names.begin()] = w;
+    total += w;
+  }
+  if (!total)
+    die("need a non-zero weight in --mix");
+}
+
+// parses --key-dist: uniform, zipfian[:theta] or hotspot[:hot-keys:hot-ops]
+static key_distribution
+parse_key_dist(const string &dist)
+{
+  vector<string> parts;
+  istringstream in(dist);
+  string part;
+  while (getline(in, part, ':'))
+    parts.push_back(part);
+  if (parts.empty())
+    die("invalid --key-dist");
+  if (parts[0] == "uniform" && parts.size() == 1)
+    return key_distribution::uniform(g_key_range);
+  if (parts[0] == "zipfian" && parts.size() <= 2) {
+    const double theta = parts.size() > 1 ? strtod(parts[1].c_str(), NULL) : 0.99;
+    if (theta <= 0.0)
+      die("need a zipfian theta > 0");
+    return key_distribution::zipfian(g_key_range, theta);
+  }
+  if (parts[0] == "hotspot" && (parts.size() == 1 || parts.size() == 3)) {
+    double hot_keys = 0.2, hot_ops = 0.8;
+    if (parts.size() == 3) {
+      hot_keys = strtod(parts[1].c_str(), NULL);
+      hot_ops = strtod(parts[2].c_str(), NULL);
+    }
+    if (hot_keys <= 0.0 || hot_keys >= 1.0 || hot_ops < 0.0 || hot_ops > 1.0)
+      die("need 0 < hot-keys < 1 and 0 <= hot-ops <= 1");
+    return key_distribution::hotspot(g_key_range, hot_keys, hot_ops);
+  }
+  die("invalid --key-dist");
+}
+
 int
 main(int argc, char **argv)
 {
@@ -235,18 +1551,40 @@ main(int argc, char **argv)
 
   string bench_type = "readonly";
   string policy_type = "global_lock";
+  string value_type = "int";
+  string readonly_op_type = "size";
+  bool value_size_set = false;
   for (;;) {
     static struct option long_options[] =
     {
       {"verbose",      no_argument,       &g_verbose, 1 },
+      {"perf-counters",no_argument,       &g_perf_counters, 1 },
+      {"bulk-remove",  no_argument,       &g_bulk_remove, 1 },
       {"bench",        required_argument, 0,         'b'},
       {"policy",       required_argument, 0,         'p'},
       {"num-threads",  required_argument, 0,         't'},
       {"runtime",      required_argument, 0,         'r'},
+      {"value-type",   required_argument, 0,         'V'},
+      {"readonly-op",  required_argument, 0,         'o'},
+      {"backoff",      required_argument, 0,         'k'},
+      {"num-producers",required_argument, 0,         'P'},
+      {"lock-type",    required_argument, 0,         'L'},
+      {"oversubscribe",required_argument, 0,         'O'},
+      {"latency-sample",required_argument, 0,        'l'},
+      {"pin",          required_argument, 0,         'C'},
+      {"mix",          required_argument, 0,         'm'},
+      {"key-dist",     required_argument, 0,         'K'},
+      {"key-range",    required_argument, 0,         'R'},
+      {"pin-gc",       required_argument, 0,         'G'},
+      {"initial-size", required_argument, 0,         'I'},
+      {"sample-interval",required_argument, 0,       'i'},
+      {"timeseries",   required_argument, 0,         'T'},
+      {"value-size",   required_argument, 0,         'S'},
+      {"format",       required_argument, 0,         'F'},
       {0, 0, 0, 0}
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "vb:t:r:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "vb:t:r:V:o:k:P:L:O:l:C:G:m:K:R:I:S:i:T:F:", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -277,6 +1615,86 @@ main(int argc, char **argv)
         die("need --runtime > 0");
       break;
 
+    case 'V':
+      value_type = optarg;
+      break;
+
+    case 'o':
+      readonly_op_type = optarg;
+      break;
+
+    case 'k':
+      g_backoff_type = optarg;
+      break;
+
+    case 'L':
+      g_lock_type = optarg;
+      break;
+
+    case 'P':
+      g_nproducers = strtoul(optarg, NULL, 10);
+      g_nproducers_set = true;
+      break;
+
+    case 'l':
+      g_latency_sample = strtoull(optarg, NULL, 10);
+      break;
+
+    case 'm':
+      g_mix = optarg;
+      break;
+
+    case 'K':
+      g_key_dist = optarg;
+      break;
+
+    case 'R':
+      g_key_range = strtoull(optarg, NULL, 10);
+      if (g_key_range <= 1)
+        die("need --key-range > 1");
+      break;
+
+    case 'I':
+      g_initial_size = strtoull(optarg, NULL, 10);
+      if (g_initial_size <= 0)
+        die("need --initial-size > 0");
+      break;
+
+    case 'i':
+      g_sample_msec = strtoull(optarg, NULL, 10);
+      if (g_sample_msec <= 0)
+        die("need --sample-interval > 0");
+      break;
+
+    case 'T':
+      g_timeseries_path = optarg;
+      break;
+
+    case 'S':
+      g_value_size = strtoull(optarg, NULL, 10);
+      value_size_set = true;
+      break;
+
+    case 'F':
+      g_format = optarg;
+      break;
+
+    case 'C':
+      g_pin = optarg;
+      break;
+
+    case 'G':
+      g_pin_gc = strtol(optarg, NULL, 10);
+      if (g_pin_gc < 0)
+        die("need --pin-gc >= 0");
+      break;
+
+    case 'O':
+      g_oversubscribe = strtoul(optarg, NULL, 10);
+      if (g_oversubscribe <= 0)
+        die("need --oversubscribe > 0");
+      break;
+
     case '?':
       /* getopt_long already printed an error message. */
       break;
@@ -287,48 +1705,216 @@ main(int argc, char **argv)
   }
 
   const set<string> valid_bench_types =
-    {"readonly", "queue"};
+    {"readonly", "queue", "remove", "mixed", "lock"};
   const set<string> valid_policy_types =
-    {"global_lock", "per_node_lock", "lock_free", "lock_free_rcu"};
+    {"global_lock", "global_rwlock", "global_seqlock", "per_node_lock",
+     "lock_free", "lock_free_rcu", "lazy", "two_lock_queue", "null"};
+  const set<string> valid_value_types =
+    {"int", "string", "payload"};
+  const set<size_t> valid_value_sizes =
+    {64, 256, 1024};
+  const set<string> valid_backoff_types =
+    {"none", "exp", "rand", "adaptive"};
+  const set<string> valid_lock_types =
+    {"", "tas", "ttas", "ttas-exp", "ttas-prop", "mutex", "mcs", "clh",
+     "hybrid", "cohort"};
 
   if (!valid_bench_types.count(bench_type))
     die("invalid --bench");
 
+  if (g_format != "text" && g_format != "json")
+    die("invalid --format");
+  if (g_format == "json" && g_verbose)
+    die("--verbose requires --format text");
+
   if (!valid_policy_types.count(policy_type))
     die("invalid --policy");
 
-  unique_ptr<benchmark> p;
+  if (!valid_value_types.count(value_type))
+    die("invalid --value-type");
+  if (!valid_value_sizes.count(g_value_size))
+    die("invalid --value-size");
+  if (value_size_set && value_type != "payload")
+    die("--value-size requires --value-type payload");
+
+  if (!valid_backoff_types.count(g_backoff_type))
+    die("invalid --backoff");
+
+  if (!valid_lock_types.count(g_lock_type))
+    die("invalid --lock-type");
+  if (bench_type == "lock" && g_lock_type.empty())
+    g_lock_type = "ttas";
+  if (bench_type != "lock" && !g_lock_type.empty() &&
+      policy_type != "global_lock" && policy_type != "per_node_lock")
+    die("--lock-type requires --policy global_lock or per_node_lock");
+
+  const size_t ncpus = max(thread::hardware_concurrency(), 1u);
+  if (g_oversubscribe)
+    g_nthreads = g_oversubscribe * ncpus;
+
+  if (!g_nproducers_set)
+    g_nproducers = g_nthreads / 2;
+  else if (g_nproducers > g_nthreads)
+    die("need --num-producers <= --num-threads");
 
-  // XXX(stephentu): there must be a better way to do this, but leave it for
-  // now
-  if (bench_type == "readonly") {
-    if (policy_type == "global_lock")
-      p.reset(new read_only_benchmark<typename ll_policy<int>::global_lock>);
-    else if (policy_type == "per_node_lock")
-      p.reset(new read_only_benchmark<typename ll_policy<int>::per_node_lock>);
-    else if (policy_type == "lock_free")
-      p.reset(new read_only_benchmark<typename ll_policy<int>::lock_free>);
-    else if (policy_type == "lock_free_rcu")
-      p.reset(new read_only_benchmark<typename ll_policy<int>::lock_free_rcu>);
-  } else if (bench_type == "queue") {
-    if (policy_type == "global_lock")
-      p.reset(new queue_benchmark<typename ll_policy<int>::global_lock>);
-    else if (policy_type == "per_node_lock")
-      p.reset(new queue_benchmark<typename ll_policy<int>::per_node_lock>);
-    else if (policy_type == "lock_free")
-      p.reset(new queue_benchmark<typename ll_policy<int>::lock_free>);
-    else if (policy_type == "lock_free_rcu")
-      p.reset(new queue_benchmark<typename ll_policy<int>::lock_free_rcu>);
+  if (g_pin == "compact")
+    g_pin_cpus = topology::compact_order();
+  else if (g_pin == "scatter")
+    g_pin_cpus = topology::scatter_order();
+  else if (g_pin != "none") {
+    g_pin_cpus = topology::parse_cpulist(g_pin);
+    if (g_pin_cpus.empty())
+      die("invalid --pin");
   }
+  if (g_pin_gc >= 0 && !rcu::pin_gc_thread(g_pin_gc))
+    die("could not pin the RCU GC thread to cpu " + to_string(g_pin_gc));
+
+  parse_mix(g_mix);
+  g_keys.reset(new key_distribution(parse_key_dist(g_key_dist)));
+
+  g_readonly_op_name = readonly_op_type;
+  g_latency_label = bench_type == "lock" ? g_lock_type : policy_type;
+
+  if (readonly_op_type == "size")
+    g_readonly_op = READONLY_OP_SIZE;
+  else if (readonly_op_type == "iterate")
+    g_readonly_op = READONLY_OP_ITERATE;
+  else if (readonly_op_type == "raw-iterate")
+    g_readonly_op = READONLY_OP_RAW_ITERATE;
+  else if (readonly_op_type == "for-each")
+    g_readonly_op = READONLY_OP_FOR_EACH;
+  else
+    die("invalid --readonly-op");
+
+  const set<string> raw_iteration_policy_types =
+    {"lock_free_rcu", "lazy"};
+  if (g_readonly_op == READONLY_OP_RAW_ITERATE &&
+      !raw_iteration_policy_types.count(policy_type))
+    die("--readonly-op raw-iterate requires --policy lock_free_rcu or lazy");
+
+  unique_ptr<benchmark> p;
+  if (bench_type == "lock")
+    // doesn't involve a list, so --policy and --value-type don't apply
+    p.reset(make_locked_benchmark<lock_benchmark_maker>(g_lock_type));
+  else if (value_type == "int")
+    p.reset(make_value_benchmark<int>(bench_type, policy_type));
+  else if (value_type == "string")
+    p.reset(make_value_benchmark<string>(bench_type, policy_type));
+  else if (value_type == "payload")
+    p.reset(make_payload_benchmark(bench_type, policy_type));
+  assert(p);
 
   if (g_verbose) {
     cout << "bench configuration:" << endl
          << "  bench      : " << bench_type << endl
          << "  policy     : " << policy_type << endl
-         << "  num-threads: " << g_nthreads << endl
-         << "  runtime    : " << g_duration_sec << " sec" << endl;
+         << "  value-type : " << value_type;
+    if (value_type == "payload")
+      cout << " (" << g_value_size << " bytes)";
+    cout << endl
+         << "  init-size  : "
+         << (g_initial_size ? to_string(g_initial_size) : "default") << endl
+         << "  readonly-op: " << readonly_op_type << endl
+         << "  bulk-remove: " << (g_bulk_remove ? "yes" : "no") << endl
+         << "  backoff    : " << g_backoff_type << endl
+         << "  producers  : " << g_nproducers << endl
+         << "  lock-type  : " << (g_lock_type.empty() ? "default" : g_lock_type) << endl
+         << "  mix        : " << g_mix << endl
+         << "  keys       : " << g_keys->describe() << endl
+         << "  num-threads: " << g_nthreads
+         << " (" << ncpus << " cpus)" << endl
+         << "  runtime    : " << g_duration_sec << " sec" << endl
+         << "  clock      : " << (tsc_clock::uses_tsc() ? "tsc" : "clock_gettime")
+         << " (" << tsc_clock::ticks_per_nsec() << " ticks/ns)" << endl
+         << "  pin        : " << g_pin;
+    if (!g_pin_cpus.empty()) {
+      // the CPU of every worker, in order
+      cout << " (cpus";
+      for (size_t i = 0; i < g_nthreads; i++)
+        cout << (i ? "," : " ") << g_pin_cpus[i % g_pin_cpus.size()];
+      cout << ")";
+    }
+    cout << endl
+         << "  pin-gc     : ";
+    if (g_pin_gc >= 0)
+      cout << "cpu " << g_pin_gc << endl;
+    else
+      cout << "none" << endl;
+    cout << "  lock-prof  : " << (lock_profile::enabled() ? "on" : "off") << endl
+         << "  perf-ctrs  : " << (g_perf_counters ? "on" : "off") << endl
+         << "  sampling   : every " << g_sample_msec << " ms";
+    if (!g_timeseries_path.empty())
+      cout << ", to " << g_timeseries_path;
+    cout << endl
+         << "  lat-sample : ";
+    if (g_latency_sample)
+      cout << "1/" << g_latency_sample << " ops" << endl;
+    else
+      cout << "off" << endl;
+  }
+
+  if (g_format == "json") {
+    json_writer json(cout);
+    json.begin_object();
+    json.key("config");
+    json.begin_object();
+    json.field("bench", bench_type);
+    json.field("policy", policy_type);
+    json.field("value_type", value_type);
+    if (value_type == "payload")
+      json.field("value_size", g_value_size);
+    // 0 is the benchmark's default (see memory.initial_elems)
+    json.field("initial_size", g_initial_size);
+    json.field("readonly_op", readonly_op_type);
+    json.field("bulk_remove", bool(g_bulk_remove));
+    json.field("backoff", g_backoff_type);
+    json.field("producers", g_nproducers);
+    json.field("lock_type", g_lock_type.empty() ? "default" : g_lock_type);
+    json.field("mix", g_mix);
+    json.field("keys", g_keys->describe());
+    json.field("num_threads", g_nthreads);
+    json.field("cpus", ncpus);
+    json.field("runtime_sec", g_duration_sec);
+    json.field("clock", tsc_clock::uses_tsc() ? "tsc" : "clock_gettime");
+    json.field("ticks_per_nsec", tsc_clock::ticks_per_nsec());
+    json.field("pin", g_pin);
+    json.key("pin_cpus");
+    json.begin_array();
+    for (size_t i = 0; i < g_nthreads && !g_pin_cpus.empty(); i++)
+      json.value(g_pin_cpus[i % g_pin_cpus.size()]);
+    json.end_array();
+    json.field("pin_gc", g_pin_gc);
+    json.field("lock_profile", lock_profile::enabled());
+    json.field("perf_counters", bool(g_perf_counters));
+    json.field("sample_interval_ms", g_sample_msec);
+    json.field("latency_sample", g_latency_sample);
+    json.end_object();
+    json.key("results");
+    p->do_bench(&json);
+    if (lock_profile::enabled()) {
+      json.key("lock_sites");
+      json.begin_array();
+      for (auto &row : lock_profile::totals()) {
+        const vector<uint64_t> &t = row.second;
+        if (!t[lock_profile::ACQUISITIONS])
+          continue;
+        json.begin_object();
+        json.field("name", row.first);
+        json.field("acquisitions", t[lock_profile::ACQUISITIONS]);
+        json.field("failed", t[lock_profile::FAILED]);
+        json.field("spins", t[lock_profile::SPINS]);
+        json.field("hold_cycles", t[lock_profile::HOLD_CYCLES]);
+        json.end_object();
+      }
+      json.end_array();
+    }
+    json.end_object();
+    cout << endl;
+    return 0;
   }
 
-  p->do_bench();
+  p->do_bench(nullptr);
+  if (g_verbose && lock_profile::enabled())
+    lock_profile::print(cout);
   return 0;
 }
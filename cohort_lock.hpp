@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "asm.hpp"
+#include "lock_profile.hpp"
+#include "macros.hpp"
+#include "topology.hpp"
+
+/**
+ * NUMA-aware cohort lock (Dice, Marathe and Shavit): a global lock, plus a
+ * local lock per NUMA node. A thread first acquires its node's local lock,
+ * and then the global lock, unless its node (its "cohort") already holds it.
+ * Upon release, if another thread of the same node is waiting on the local
+ * lock, the global lock is passed to it along w/ the local lock, so the lock
+ * (and the data it protects) stays within the node's caches. After
+ * MaxPasses consecutive local handoffs, the global lock is released anyway,
+ * so that other nodes don't starve.
+ *
+ * Both levels are ticket locks: the global lock is released by whichever
+ * thread of the cohort ends up holding it, so it must not care about which
+ * thread acquired it, and the local ticket counters tell whether anybody is
+ * waiting. The node of a thread is read upon every lock(), so a thread
+ * which migrates simply joins another cohort.
+ *
+ * On a single node machine, this degenerates to a ticket lock, which hands
+ * the global lock over MaxPasses times in a row.
+ *
+ * implements Lockable concept (C++11)
+ */
+template <unsigned int MaxPasses = 64>
+class cohort_lock {
+public:
+  cohort_lock()
+    : nnodes_(topology::num_nodes()), nodes_(nullptr), holder_node_(0)
+  {
+    // per-node state lives in its own cache aligned allocation, so that
+    // embedding a cohort_lock doesn't force an extended alignment onto its
+    // owner
+    void *p = nullptr;
+    if (posix_memalign(&p, CACHELINE_SIZE, sizeof(local_state) * nnodes_))
+      throw std::bad_alloc();
+    nodes_ = static_cast<local_state *>(p);
+    for (size_t i = 0; i < nnodes_; i++)
+      new (&nodes_[i]) local_state();
+  }
+
+  ~cohort_lock()
+  {
+    for (size_t i = 0; i < nnodes_; i++)
+      nodes_[i].~local_state();
+    free(nodes_);
+  }
+
+  // non-copyable/non-movable
+  cohort_lock(const cohort_lock &) = delete;
+  cohort_lock(cohort_lock &&) = delete;
+  cohort_lock &operator=(const cohort_lock &) = delete;
+
+  inline void
+  lock()
+  {
+    const unsigned int n = local_node();
+    local_state &s = nodes_[n];
+    s.local_.lock();
+    if (!s.global_held_) {
+      global_.lock();
+      s.global_held_ = true;
+      s.npasses_ = 0;
+    }
+    holder_node_ = n;
+  }
+
+  inline void
+  unlock()
+  {
+    local_state &s = nodes_[holder_node_];
+    if (s.local_.has_waiters() && s.npasses_ < MaxPasses) {
+      // keep the global lock in the cohort
+      s.npasses_++;
+    } else {
+      s.global_held_ = false;
+      global_.unlock();
+    }
+    s.local_.unlock();
+  }
+
+  inline bool
+  try_lock()
+  {
+    const unsigned int n = local_node();
+    local_state &s = nodes_[n];
+    if (!s.local_.try_lock())
+      return false;
+    if (!s.global_held_) {
+      if (!global_.try_lock()) {
+        s.local_.unlock();
+        return false;
+      }
+      s.global_held_ = true;
+      s.npasses_ = 0;
+    }
+    holder_node_ = n;
+    return true;
+  }
+
+private:
+  // FIFO spinlock, which can be released by a thread other than the one
+  // which acquired it
+  class ticket_lock {
+  public:
+    ticket_lock() : next_(0), serving_(0) {}
+
+    inline void
+    lock()
+    {
+      const uint32_t t = next_.fetch_add(1, std::memory_order_relaxed);
+      while (serving_.load(std::memory_order_acquire) != t)
+        lock_profile::spin();
+    }
+
+    inline void
+    unlock()
+    {
+      // only the holder writes serving_
+      serving_.store(serving_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    }
+
+    inline bool
+    try_lock()
+    {
+      uint32_t t = serving_.load(std::memory_order_acquire);
+      return next_.compare_exchange_strong(t, t + 1,
+                                           std::memory_order_acquire);
+    }
+
+    // whether anybody is queued up behind the holder
+    inline bool
+    has_waiters() const
+    {
+      return next_.load(std::memory_order_relaxed) -
+             serving_.load(std::memory_order_relaxed) > 1;
+    }
+
+  private:
+    std::atomic<uint32_t> next_;
+    std::atomic<uint32_t> serving_;
+  };
+
+  struct local_state {
+    local_state() : local_(), global_held_(false), npasses_(0) {}
+    ticket_lock local_;
+    // only accessed w/ local_ held
+    bool global_held_;
+    unsigned int npasses_;
+    CACHE_PADOUT;
+  } CACHE_ALIGNED;
+
+  inline unsigned int
+  local_node() const
+  {
+    const unsigned int n = topology::current_node();
+    return likely(n < nnodes_) ? n : 0;
+  }
+
+  const size_t nnodes_;
+  local_state *nodes_;
+  ticket_lock global_;
+  unsigned int holder_node_; // only accessed by the holder
+};
@@ -1,27 +1,63 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <memory>
 #include <mutex>
 #include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "macros.hpp"
+#include "rcu.hpp"
+#include "rwlock.hpp"
+#include "lock_profile.hpp"
+
+namespace private_ {
+  LOCK_SITE(global_lock_site, "global_lock_impl::mutex_");
+}
 
 /**
- * Standard singly-linked list with a global lock for protection, and
- * standard reference counting
+ * Standard singly-linked list with a global lock for protection
+ *
+ * size() and empty() are O(1), and take no lock: the number of elements is
+ * maintained under the lock, and read atomically.
+ *
+ * How the other readers (front(), back(), for_each() and iteration)
+ * synchronize depends on lock_read_traits<LockImpl>:
+ *   - exclusive (eg std::mutex): readers take the lock like writers do
+ *   - shared (eg rwlock): readers share the lock w/ each other
+ *   - optimistic (eg seqlock): front() and back() take no lock, and
+ *     retry if a writer ran concurrently. unlinked nodes are then reclaimed
+ *     via RCU, since readers might still be looking at them. for_each() and
+ *     iteration hand values out to the caller, which cannot be undone, so
+ *     they take the lock exclusively
  *
  * References returned by this implementation are guaranteed to be valid
  * until the element is removed from the list
  */
-template <typename T>
+template <typename T, typename LockImpl = std::mutex>
 class global_lock_impl {
 private:
 
-  struct node;
-  typedef std::unique_lock<std::mutex> unique_lock;
-  typedef std::shared_ptr<unique_lock> unique_lock_ptr;
-  typedef std::shared_ptr<node> node_ptr;
+  typedef typename lock_read_traits<LockImpl>::read_tag read_tag;
+  static const bool optimistic_reads =
+    std::is_same<read_tag, optimistic_read_tag>::value;
+
+  // only profiled when readers lock it like writers do, since profiled_lock
+  // has no shared/optimistic read interface
+  typedef typename std::conditional<
+    std::is_same<read_tag, exclusive_read_tag>::value,
+    site_lock<LockImpl, private_::global_lock_site>, LockImpl>::type
+    lock_type;
+
+  typedef std::unique_lock<lock_type> unique_lock;
+  // the lock held by an iterator
+  typedef typename std::conditional<
+    std::is_same<read_tag, shared_read_tag>::value,
+    shared_lock_guard<LockImpl>, unique_lock>::type iterator_lock;
+  typedef std::shared_ptr<iterator_lock> iterator_lock_ptr;
 
   struct node {
     // non-copyable
@@ -30,22 +66,33 @@ private:
     node &operator=(const node &) = delete;
 
     node() : value_(), next_() {}
-    node(const T &value, const node_ptr &next)
-      : value_(value), next_(next) {}
+
+    // value_ is constructed in place from args
+    template <typename... Args>
+    explicit node(node *next, Args &&... args)
+      : value_(std::forward<Args>(args)...), next_(next) {}
 
     T value_;
-    node_ptr next_;
+
+    // atomic only so that optimistic readers can load it w/o holding the
+    // lock. the loads and stores are plain moves on x86
+    std::atomic<node *> next_;
+
+    inline node *
+    next() const
+    {
+      return next_.load(std::memory_order_acquire);
+    }
   };
 
-  mutable std::mutex mutex_;
-  node_ptr head_;
-  node_ptr tail_;
+  mutable lock_type mutex_;
+  std::atomic<node *> head_;
+  std::atomic<node *> tail_;
+  std::atomic<size_t> size_; // only written w/ the lock held
 
   struct iterator_ : public std::iterator<std::forward_iterator_tag, T> {
     iterator_() : lock_(), node_() {}
-    iterator_(const unique_lock_ptr &lock, const node_ptr &node)
-      : lock_(lock), node_(node) {}
-    iterator_(unique_lock_ptr &&lock, const node_ptr &node)
+    iterator_(iterator_lock_ptr &&lock, node *node)
       : lock_(std::move(lock)), node_(node) {}
 
     T &
@@ -75,7 +122,7 @@ private:
     iterator_ &
     operator++()
     {
-      node_ = node_->next_;
+      node_ = node_->next();
       return *this;
     }
 
@@ -87,35 +134,46 @@ private:
       return cur;
     }
 
-    unique_lock_ptr lock_;
-    node_ptr node_;
+    iterator_lock_ptr lock_;
+    node *node_;
   };
 
 public:
 
   typedef iterator_ iterator;
 
-  global_lock_impl() : mutex_(), head_(), tail_() {}
+  global_lock_impl()
+    : mutex_(), head_(nullptr), tail_(nullptr), size_(0) {}
 
-  size_t
-  size() const
+  ~global_lock_impl()
   {
-    unique_lock l(mutex_);
-    size_t ret = 0;
-    node_ptr cur = head_;
+    // can do this non-thread safe, since we know there are no other users
+    node *cur = head_.load(std::memory_order_relaxed);
     while (cur) {
-      ret++;
-      cur = cur->next_;
+      node *next = cur->next();
+      delete cur;
+      cur = next;
     }
-    return ret;
+  }
+
+  inline size_t
+  size() const
+  {
+    return size_.load(std::memory_order_acquire);
+  }
+
+  inline bool
+  empty() const
+  {
+    return !head_.load(std::memory_order_acquire);
   }
 
   inline T &
   front()
   {
-    unique_lock l(mutex_);
-    assert(head_);
-    return head_->value_;
+    node *p = read([this]() { return head_.load(std::memory_order_acquire); });
+    assert(p);
+    return p->value_;
   }
 
   inline const T &
@@ -127,10 +185,9 @@ public:
   inline T &
   back()
   {
-    unique_lock l(mutex_);
-    assert(tail_);
-    assert(!tail_->next_);
-    return tail_->value_;
+    node *p = read([this]() { return tail_.load(std::memory_order_acquire); });
+    assert(p);
+    return p->value_;
   }
 
   inline const T &
@@ -143,74 +200,184 @@ public:
   pop_front()
   {
     unique_lock l(mutex_);
-    assert(head_);
-    node_ptr next = head_->next_;
-    head_ = next;
-    if (!head_)
-      tail_.reset();
+    node *p = head_.load(std::memory_order_relaxed);
+    assert(p);
+    unlink_front(p);
+    l.unlock();
+    retire(p);
   }
 
+  template <typename... Args>
   void
-  push_back(const T &val)
+  emplace_back(Args &&... args)
   {
+    // construct the value outside of the critical section
+    node *n = new node(nullptr, std::forward<Args>(args)...);
     unique_lock l(mutex_);
-    node_ptr n(std::make_shared<node>(val, nullptr));
-    if (!tail_) {
-      assert(!head_);
-      head_ = tail_ = n;
+    node *t = tail_.load(std::memory_order_relaxed);
+    if (!t) {
+      assert(!head_.load(std::memory_order_relaxed));
+      head_.store(n, std::memory_order_release);
     } else {
-      tail_->next_ = n;
-      tail_ = n;
+      t->next_.store(n, std::memory_order_release);
     }
+    tail_.store(n, std::memory_order_release);
+    size_.store(size_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
   }
 
   inline void
   remove(const T &val)
   {
-    unique_lock l(mutex_);
-    node_ptr prev;
-    node_ptr p = head_, *pp = &head_;
-    while (p) {
-      if (p->value_ == val) {
-        // unlink
-        *pp = p->next_;
-        p = *pp;
-        if (!*pp)
-          // removed last value
-          tail_ = prev;
-      } else {
-        prev = p;
-        pp = &p->next_;
-        p = p->next_;
+    remove_if([&val](const T &v) { return v == val; });
+  }
+
+  template <typename Predicate>
+  void
+  remove_if(Predicate pred)
+  {
+    // unlinked nodes are freed once the lock is released
+    std::vector<node *> unlinked;
+    {
+      unique_lock l(mutex_);
+      node *prev = nullptr;
+      std::atomic<node *> *pp = &head_;
+      node *p = pp->load(std::memory_order_relaxed);
+      while (p) {
+        node *next = p->next();
+        if (pred(p->value_)) {
+          // unlink
+          pp->store(next, std::memory_order_release);
+          if (!next)
+            // removed last value
+            tail_.store(prev, std::memory_order_release);
+          unlinked.push_back(p);
+        } else {
+          prev = p;
+          pp = &p->next_;
+        }
+        p = next;
       }
+      if (!unlinked.empty())
+        size_.store(size_.load(std::memory_order_relaxed) - unlinked.size(),
+                    std::memory_order_release);
     }
+    if (!unlinked.empty())
+      retire_batch(unlinked.data(), unlinked.size());
   }
 
   std::pair<bool, T>
   try_pop_front()
   {
     unique_lock l(mutex_);
-    if (unlikely(!head_)) {
-      assert(!tail_);
+    node *p = head_.load(std::memory_order_relaxed);
+    if (unlikely(!p)) {
+      assert(!tail_.load(std::memory_order_relaxed));
       return std::make_pair(false, T());
     }
-    T t = head_->value_;
-    node_ptr next = head_->next_;
-    head_ = next;
-    if (!head_)
-      tail_.reset();
-    return std::make_pair(true, t);
+    unlink_front(p);
+    l.unlock();
+    // p is no longer reachable by writers, so its value can be moved out
+    // w/o the lock
+    T t(std::move(p->value_));
+    retire(p);
+    return std::make_pair(true, std::move(t));
+  }
+
+  // Invokes fn on every element, under the global lock. fn must not call
+  // back into the list.
+  template <typename Function>
+  void
+  for_each(Function fn)
+  {
+    iterator_lock l(mutex_);
+    for (node *p = head_.load(std::memory_order_relaxed); p; p = p->next())
+      fn(p->value_);
   }
 
   iterator
   begin()
   {
-    return iterator_(std::move(std::make_shared<unique_lock>(mutex_)), head_);
+    iterator_lock_ptr l(std::make_shared<iterator_lock>(mutex_));
+    node *p = head_.load(std::memory_order_relaxed);
+    return iterator_(std::move(l), p);
   }
 
   iterator
   end()
   {
-    return iterator_(unique_lock_ptr(), node_ptr());
+    return iterator_();
+  }
+
+private:
+
+  // runs fn w/ the appropriate protection against writers, and returns its
+  // result. fn must not have side effects, since it may run several times
+  template <typename Function>
+  inline auto
+  read(Function fn) const -> decltype(fn())
+  {
+    return read(fn, read_tag());
+  }
+
+  template <typename Function>
+  inline auto
+  read(Function fn, exclusive_read_tag) const -> decltype(fn())
+  {
+    unique_lock l(mutex_);
+    return fn();
+  }
+
+  template <typename Function>
+  inline auto
+  read(Function fn, shared_read_tag) const -> decltype(fn())
+  {
+    shared_lock_guard<LockImpl> l(mutex_);
+    return fn();
+  }
+
+  template <typename Function>
+  inline auto
+  read(Function fn, optimistic_read_tag) const -> decltype(fn())
+  {
+    // keeps the nodes fn looks at from being reclaimed
+    scoped_rcu_region region UNUSED;
+    for (;;) {
+      const uint64_t v = mutex_.read_begin();
+      auto ret = fn();
+      if (likely(!mutex_.read_retry(v)))
+        return ret;
+    }
+  }
+
+  // p must be the first node, and the lock must be held
+  inline void
+  unlink_front(node *p)
+  {
+    node *next = p->next();
+    head_.store(next, std::memory_order_release);
+    if (!next)
+      tail_.store(nullptr, std::memory_order_release);
+    size_.store(size_.load(std::memory_order_relaxed) - 1,
+                std::memory_order_release);
+  }
+
+  // frees p, which must be unlinked, once no reader can be looking at it
+  inline void
+  retire(node *p)
+  {
+    retire_batch(&p, 1);
+  }
+
+  void
+  retire_batch(node *const *ps, size_t n)
+  {
+    if (!optimistic_reads) {
+      for (size_t i = 0; i < n; i++)
+        delete ps[i];
+    } else {
+      scoped_rcu_region region;
+      region.release_batch(ps, n);
+    }
   }
 };
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * HDR-style histogram of non-negative integer values (eg latencies in ns).
+ *
+ * Values below 2^SubBucketBits are counted exactly. Above that, every power
+ * of two range [2^e, 2^(e+1)) is split into 2^SubBucketBits equally sized
+ * buckets, so a value is known to within a relative error of
+ * 2^-SubBucketBits (~6% by default), over the entire 64-bit range, in a fixed
+ * amount of memory. Recording a value is a couple of bit operations and an
+ * increment, so that workers can record on their own histograms in the hot
+ * path, and merge them afterwards.
+ *
+ * Not thread-safe.
+ */
+template <unsigned int SubBucketBits = 4>
+class log_histogram {
+public:
+  static const size_t NSubBuckets = size_t(1) << SubBucketBits;
+  static const size_t NBuckets = (64 - SubBucketBits + 1) * NSubBuckets;
+
+  log_histogram() : count_(0), max_(0)
+  {
+    memset(buckets_, 0, sizeof(buckets_));
+  }
+
+  inline void
+  record(uint64_t v)
+  {
+    buckets_[bucket_of(v)]++;
+    count_++;
+    max_ = std::max(max_, v);
+  }
+
+  void
+  merge(const log_histogram &o)
+  {
+    for (size_t i = 0; i < NBuckets; i++)
+      buckets_[i] += o.buckets_[i];
+    count_ += o.count_;
+    max_ = std::max(max_, o.max_);
+  }
+
+  inline uint64_t
+  count() const
+  {
+    return count_;
+  }
+
+  inline uint64_t
+  max() const
+  {
+    return max_;
+  }
+
+  // the smallest value v such that at least a fraction p (in [0, 1]) of the
+  // recorded values are <= v, up to the bucket resolution (reported as the
+  // bucket's upper bound, but never above max()). 0 if nothing was recorded
+  uint64_t
+  percentile(double p) const
+  {
+    if (!count_)
+      return 0;
+    uint64_t rank = uint64_t(p * count_ + 0.5);
+    rank = std::min(std::max(rank, uint64_t(1)), count_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NBuckets; i++) {
+      seen += buckets_[i];
+      if (seen >= rank)
+        return std::min(upper_bound_of(i), max_);
+    }
+    return max_;
+  }
+
+  static inline size_t
+  bucket_of(uint64_t v)
+  {
+    if (v < NSubBuckets)
+      return v;
+    const unsigned int e = 63 - __builtin_clzll(v);
+    const unsigned int shift = e - SubBucketBits;
+    // (v >> shift) is in [NSubBuckets, 2 * NSubBuckets)
+    return (shift + 1) * NSubBuckets + ((v >> shift) - NSubBuckets);
+  }
+
+  // the largest value which falls into bucket i
+  static inline uint64_t
+  upper_bound_of(size_t i)
+  {
+    if (i < NSubBuckets)
+      return i;
+    const unsigned int shift = i / NSubBuckets - 1;
+    const uint64_t lo = (NSubBuckets + i % NSubBuckets) << shift;
+    return lo + ((uint64_t(1) << shift) - 1);
+  }
+
+private:
+  uint64_t buckets_[NBuckets];
+  uint64_t count_;
+  uint64_t max_;
+};
+
+typedef log_histogram<> latency_histogram;
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "asm.hpp"
+#include "lock_profile.hpp"
+#include "macros.hpp"
+
+/**
+ * Spin-then-park lock: waiters spin for a while, in case the holder is about
+ * to release the lock, and then go to sleep on a futex. Pure spinlocks fall
+ * apart when there are more threads than cores, since waiters then burn
+ * entire scheduling quanta while the holder is descheduled; parking hands the
+ * core back to the holder instead.
+ *
+ * The spin budget adapts to how long the lock is held: when spinning pays
+ * off, the budget moves towards twice the number of spins it took, and when
+ * it doesn't, the budget decays, so that waiters park right away on a lock
+ * which is held for long (or whose holder keeps getting descheduled).
+ *
+ * The lock word follows Drepper's "Futexes Are Tricky" (mutex #3): 0 is
+ * unlocked, 1 is locked, and 2 is locked w/ (possibly) parked waiters, so
+ * unlock() only makes a syscall when somebody might be asleep.
+ *
+ * implements Lockable concept (C++11)
+ */
+template <unsigned int MinSpins = 16, unsigned int MaxSpins = 4096>
+class hybrid_lock {
+public:
+  hybrid_lock() : state_(Unlocked), spin_budget_(MinSpins) {}
+
+  // non-copyable/non-movable
+  hybrid_lock(const hybrid_lock &) = delete;
+  hybrid_lock(hybrid_lock &&) = delete;
+  hybrid_lock &operator=(const hybrid_lock &) = delete;
+
+  inline void
+  lock()
+  {
+    if (likely(try_lock()))
+      return;
+    if (!spin())
+      park();
+  }
+
+  inline void
+  unlock()
+  {
+    if (state_.exchange(Unlocked, std::memory_order_release) == Contended)
+      futex(FUTEX_WAKE_PRIVATE, 1);
+  }
+
+  inline bool
+  try_lock()
+  {
+    int expected = Unlocked;
+    return state_.compare_exchange_strong(
+        expected, Locked, std::memory_order_acquire);
+  }
+
+private:
+  static const int Unlocked = 0;
+  static const int Locked = 1;
+  static const int Contended = 2;
+
+  // returns true if the lock was acquired within the spin budget
+  bool
+  spin()
+  {
+    const unsigned int budget =
+      spin_budget_.load(std::memory_order_relaxed);
+    for (unsigned int i = 0; i < budget; i++) {
+      lock_profile::spin();
+      if (state_.load(std::memory_order_relaxed) == Unlocked && try_lock()) {
+        // moving average, updated racily (it's only a hint)
+        const int target = std::min(2 * (i + 1), MaxSpins);
+        const int next = int(budget) + (target - int(budget)) / 8;
+        spin_budget_.store(std::max((unsigned int) next, MinSpins),
+                           std::memory_order_relaxed);
+        return true;
+      }
+    }
+    spin_budget_.store(std::max(budget - budget / 8, MinSpins),
+                       std::memory_order_relaxed);
+    return false;
+  }
+
+  void
+  park()
+  {
+    // announce ourselves as a waiter. if the lock was free, we now own it
+    // (marked as contended, which at worst costs an extra wake-up)
+    while (state_.exchange(Contended, std::memory_order_acquire) != Unlocked)
+      futex(FUTEX_WAIT_PRIVATE, Contended);
+  }
+
+  // FUTEX_WAIT sleeps only if the lock word still holds val
+  inline void
+  futex(int op, int val)
+  {
+    syscall(SYS_futex, reinterpret_cast<int *>(&state_), op, val,
+            nullptr, nullptr, 0);
+  }
+
+  std::atomic<int> state_;
+  std::atomic<unsigned int> spin_budget_;
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Streams JSON out to an ostream, w/o building it up in memory first.
+ *
+ * The writer keeps track of where commas go, so callers only have to pair up
+ * begin_*() and end_*(), and precede every value in an object w/ key() (or
+ * use field()). Non-finite numbers, which JSON can't represent, are written
+ * as null.
+ */
+class json_writer {
+public:
+  explicit json_writer(std::ostream &o)
+    : o_(o), first_(1, true), after_key_(false) {}
+
+  json_writer(const json_writer &) = delete;
+  json_writer &operator=(const json_writer &) = delete;
+
+  void
+  begin_object()
+  {
+    begin('{');
+  }
+
+  void
+  end_object()
+  {
+    end('}');
+  }
+
+  void
+  begin_array()
+  {
+    begin('[');
+  }
+
+  void
+  end_array()
+  {
+    end(']');
+  }
+
+  // the next value (or object, or array) is the value of k
+  void
+  key(const std::string &k)
+  {
+    separate();
+    write_string(k);
+    o_ << ": ";
+    after_key_ = true;
+  }
+
+  void
+  value(const std::string &v)
+  {
+    separate();
+    write_string(v);
+  }
+
+  void
+  value(const char *v)
+  {
+    value(std::string(v));
+  }
+
+  void
+  value(bool v)
+  {
+    separate();
+    o_ << (v ? "true" : "false");
+  }
+
+  void value(int v) { write_integer(v); }
+  void value(unsigned int v) { write_integer(v); }
+  void value(long v) { write_integer(v); }
+  void value(unsigned long v) { write_integer(v); }
+  void value(long long v) { write_integer(v); }
+  void value(unsigned long long v) { write_integer(v); }
+
+  void
+  value(double v)
+  {
+    separate();
+    if (!std::isfinite(v)) {
+      o_ << "null";
+      return;
+    }
+    // enough digits to tell apart any two throughputs we'd care about
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.12g", v);
+    o_ << buf;
+  }
+
+  template <typename T>
+  void
+  field(const std::string &k, const T &v)
+  {
+    key(k);
+    value(v);
+  }
+
+private:
+  template <typename T>
+  void
+  write_integer(T v)
+  {
+    separate();
+    o_ << v;
+  }
+
+  void
+  begin(char c)
+  {
+    separate();
+    o_ << c;
+    first_.push_back(true);
+  }
+
+  void
+  end(char c)
+  {
+    first_.pop_back();
+    o_ << c;
+  }
+
+  // writes a comma before every value but the first one of its container. a
+  // value right after its key doesn't need one
+  void
+  separate()
+  {
+    if (after_key_) {
+      after_key_ = false;
+      return;
+    }
+    if (!first_.back())
+      o_ << ", ";
+    first_.back() = false;
+  }
+
+  void
+  write_string(const std::string &s)
+  {
+    o_ << '"';
+    for (char c : s) {
+      switch (c) {
+      case '"':
+        o_ << "\\\"";
+        break;
+      case '\\':
+        o_ << "\\\\";
+        break;
+      case '\n':
+        o_ << "\\n";
+        break;
+      default:
+        if ((unsigned char) c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          o_ << buf;
+        } else
+          o_ << c;
+      }
+    }
+    o_ << '"';
+  }
+
+  std::ostream &o_;
+  std::vector<bool> first_; // per open container, whether it's still empty
+  bool after_key_;
+};
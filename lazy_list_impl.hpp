@@ -0,0 +1,440 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "macros.hpp"
+#include "rcu.hpp"
+#include "spinlock.hpp"
+#include "lock_profile.hpp"
+
+/**
+ * Singly-linked list w/ lazy synchronization, in the style of Heller et al.'s
+ * lazy list.
+ *
+ * Traversals take no locks at all. A mutation locks only the nodes it
+ * modifies (the predecessor and the victim for removals, the last node for
+ * appends), and then validates that neither was removed concurrently and
+ * that they are still adjacent. If validation fails, the mutation starts
+ * over. Removal first marks the victim (logical removal), and then unlinks it
+ * while still holding both locks, so readers never have to help out and
+ * marked nodes never stay reachable for long.
+ *
+ * Since readers hold no locks, unlinked nodes can only be reclaimed once no
+ * reader can still be looking at them, which is what ScopedImpl (RCU by
+ * default) takes care of. All read-only operations are wait-free.
+ *
+ * References returned by this implementation are guaranteed to be valid until
+ * the element is removed from the list
+ */
+namespace private_ {
+  LOCK_SITE(lazy_list_node_site, "lazy_list_impl::node::mutex_");
+}
+
+template <typename T,
+          typename LockImpl = spinlock,
+          typename ScopedImpl = scoped_rcu_region>
+class lazy_list_impl {
+private:
+
+  typedef site_lock<LockImpl, private_::lazy_list_node_site> lock_type;
+  typedef std::unique_lock<lock_type> unique_lock;
+
+  struct node {
+    // non-copyable
+    node(const node &) = delete;
+    node(node &&) = delete;
+    node &operator=(const node &) = delete;
+
+    node() : next_(nullptr), marked_(false), mutex_(), value_() {}
+
+    // value_ is constructed in place from args
+    template <typename... Args>
+    explicit node(node *next, Args &&... args)
+      : next_(next), marked_(false), mutex_(),
+        value_(std::forward<Args>(args)...) {}
+
+    // Note: next_ and marked_ are only written while holding mutex_, but are
+    // read w/o it
+    std::atomic<node *> next_;
+    std::atomic<bool> marked_;
+    mutable lock_type mutex_;
+    T value_;
+
+    inline node *
+    next() const
+    {
+      return next_.load(std::memory_order_acquire);
+    }
+
+    inline bool
+    is_marked() const
+    {
+      return marked_.load(std::memory_order_acquire);
+    }
+  };
+
+  node *const head_; // head_ points to a sentinel beginning node
+
+  // tail_ is a hint which always points to a node that is either in the list,
+  // or is marked and not yet reclaimed (see unlink())
+  mutable std::atomic<node *> tail_;
+
+  static inline node *
+  next_unmarked(node *p)
+  {
+    do {
+      p = p->next();
+    } while (p && p->is_marked());
+    return p;
+  }
+
+  struct iterator_ : public std::iterator<std::forward_iterator_tag, T> {
+    iterator_() : node_(), scoper_() {}
+    explicit iterator_(node *node) : node_(node), scoper_() {}
+
+    typedef T value_type;
+
+    T &
+    operator*() const
+    {
+      // could return deleted value
+      return node_->value_;
+    }
+
+    T *
+    operator->() const
+    {
+      // could return deleted value
+      return &node_->value_;
+    }
+
+    bool
+    operator==(const iterator_ &o) const
+    {
+      return node_ == o.node_;
+    }
+
+    bool
+    operator!=(const iterator_ &o) const
+    {
+      return !operator==(o);
+    }
+
+    iterator_ &
+    operator++()
+    {
+      node_ = next_unmarked(node_);
+      return *this;
+    }
+
+    iterator_
+    operator++(int)
+    {
+      iterator_ cur = *this;
+      ++(*this);
+      return cur;
+    }
+
+    node *node_;
+    ScopedImpl scoper_; // keeps node_ from being reclaimed
+  };
+
+  // same as iterator_, w/o a region of its own
+  struct raw_iterator_ : public std::iterator<std::forward_iterator_tag, T> {
+    raw_iterator_() : node_() {}
+    explicit raw_iterator_(node *node) : node_(node) {}
+
+    typedef T value_type;
+
+    T &
+    operator*() const
+    {
+      return node_->value_;
+    }
+
+    T *
+    operator->() const
+    {
+      return &node_->value_;
+    }
+
+    bool
+    operator==(const raw_iterator_ &o) const
+    {
+      return node_ == o.node_;
+    }
+
+    bool
+    operator!=(const raw_iterator_ &o) const
+    {
+      return !operator==(o);
+    }
+
+    raw_iterator_ &
+    operator++()
+    {
+      node_ = next_unmarked(node_);
+      return *this;
+    }
+
+    raw_iterator_
+    operator++(int)
+    {
+      raw_iterator_ cur = *this;
+      ++(*this);
+      return cur;
+    }
+
+    node *node_;
+  };
+
+public:
+
+  typedef iterator_ iterator;
+  typedef raw_iterator_ raw_iterator;
+  typedef ScopedImpl read_region;
+  static const bool supports_raw_iteration = true;
+
+  lazy_list_impl() : head_(new node), tail_(head_) {}
+
+  ~lazy_list_impl()
+  {
+    // can do this non-thread safe, since we know there are no other users.
+    // unlinked nodes are owned by ScopedImpl
+    node *cur = head_;
+    while (cur) {
+      node *next = cur->next();
+      delete cur;
+      cur = next;
+    }
+  }
+
+  size_t
+  size() const
+  {
+    ScopedImpl scoper UNUSED;
+    size_t ret = 0;
+    for (node *p = next_unmarked(head_); p; p = next_unmarked(p))
+      ret++;
+    return ret;
+  }
+
+  inline bool
+  empty() const
+  {
+    ScopedImpl scoper UNUSED;
+    return !next_unmarked(head_);
+  }
+
+  T &
+  front()
+  {
+    ScopedImpl scoper UNUSED;
+    node *p = next_unmarked(head_);
+    assert(p);
+    return p->value_;
+  }
+
+  inline const T &
+  front() const
+  {
+    return const_cast<lazy_list_impl *>(this)->front();
+  }
+
+  T &
+  back()
+  {
+    ScopedImpl scoper UNUSED;
+    for (;;) {
+      node *p = find_last();
+      assert(p != head_);
+      if (likely(!p->is_marked()))
+        return p->value_;
+    }
+  }
+
+  inline const T &
+  back() const
+  {
+    return const_cast<lazy_list_impl *>(this)->back();
+  }
+
+  void
+  pop_front()
+  {
+    bool ret UNUSED = pop_first([](T &) {});
+    assert(ret);
+  }
+
+  template <typename... Args>
+  void
+  emplace_back(Args &&... args)
+  {
+    node *n = new node(nullptr, std::forward<Args>(args)...);
+    ScopedImpl scoper UNUSED;
+    for (;;) {
+      node *last = find_last();
+      unique_lock l(last->mutex_);
+      // validate: last must still be in the list, and still be last
+      if (unlikely(last->is_marked() || last->next()))
+        continue;
+      last->next_.store(n, std::memory_order_release);
+      // published while last is locked, so nobody can unlink n (which needs
+      // the lock on its predecessor) before tail_ points to it
+      tail_.store(n, std::memory_order_release);
+      return;
+    }
+  }
+
+  inline void
+  remove(const T &val)
+  {
+    remove_if([&val](const T &v) { return v == val; });
+  }
+
+  // Unlinked nodes are handed to the scoper in one batch at the end
+  template <typename Predicate>
+  void
+  remove_if(Predicate pred)
+  {
+    ScopedImpl scoper;
+    std::vector<node *> unlinked;
+    node *prev = head_;
+    node *cur = prev->next();
+    while (cur) {
+      if (cur->is_marked() || !pred(cur->value_)) {
+        prev = cur;
+        cur = cur->next();
+        continue;
+      }
+      unique_lock l0(prev->mutex_);
+      unique_lock l1(cur->mutex_);
+      if (likely(validate(prev, cur))) {
+        unlinked.push_back(cur);
+        cur = unlink(prev, cur);
+      } else if (!prev->is_marked()) {
+        // cur was removed by somebody else
+        cur = prev->next();
+      } else {
+        // prev is gone, so we have lost our place in the list
+        prev = head_;
+        cur = prev->next();
+      }
+    }
+    if (!unlinked.empty())
+      scoper.release_batch(unlinked.data(), unlinked.size());
+  }
+
+  std::pair<bool, T>
+  try_pop_front()
+  {
+    // copied out of the node while it is locked: lock-free readers (iterators,
+    // raw iterators, references from front()/back()) don't take the lock and
+    // may still be reading the value, so it can't be moved out
+    T t;
+    if (!pop_first([&t](const T &v) { t = v; }))
+      return std::make_pair(false, T());
+    return std::make_pair(true, std::move(t));
+  }
+
+  template <typename Function>
+  void
+  for_each(Function fn)
+  {
+    ScopedImpl scoper UNUSED;
+    for (node *p = next_unmarked(head_); p; p = next_unmarked(p))
+      fn(p->value_);
+  }
+
+  iterator
+  begin()
+  {
+    ScopedImpl scoper UNUSED;
+    return iterator_(next_unmarked(head_));
+  }
+
+  iterator
+  end()
+  {
+    return iterator_();
+  }
+
+  // must be called (and the result used) from within a read_region
+  raw_iterator
+  raw_begin()
+  {
+    return raw_iterator_(next_unmarked(head_));
+  }
+
+  raw_iterator
+  raw_end()
+  {
+    return raw_iterator_();
+  }
+
+private:
+  // both prev and cur must be locked
+  inline bool
+  validate(node *prev, node *cur) const
+  {
+    return !prev->is_marked() && !cur->is_marked() && prev->next() == cur;
+  }
+
+  // marks and unlinks cur, which must be validated (and locked, along w/
+  // prev). returns the successor of cur
+  inline node *
+  unlink(node *prev, node *cur)
+  {
+    cur->marked_.store(true, std::memory_order_release);
+    node *next = cur->next();
+    prev->next_.store(next, std::memory_order_release);
+    // tail_ can only point to cur if cur is last, in which case prev becomes
+    // last. nobody can append to either of them, since we hold both locks
+    node *expected = cur;
+    tail_.compare_exchange_strong(expected, prev);
+    return next;
+  }
+
+  // unlinks the first node, after handing its value to fn. returns false if
+  // the list was empty
+  template <typename Function>
+  bool
+  pop_first(Function fn)
+  {
+    ScopedImpl scoper;
+    for (;;) {
+      node *first = head_->next();
+      if (unlikely(!first))
+        return false;
+      unique_lock l0(head_->mutex_);
+      unique_lock l1(first->mutex_);
+      if (unlikely(!validate(head_, first)))
+        continue;
+      fn(first->value_);
+      unlink(head_, first);
+      l1.unlock();
+      l0.unlock();
+      scoper.release(first);
+      return true;
+    }
+  }
+
+  // the last node in the list (possibly head_), which might have been
+  // marked by the time the caller looks at it. must be called from within a
+  // region
+  node *
+  find_last() const
+  {
+    node *p = tail_.load(std::memory_order_acquire);
+    if (unlikely(p->is_marked()))
+      p = head_;
+    for (node *next = p->next(); next; next = p->next())
+      p = next;
+    return p;
+  }
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <utility>
 
@@ -27,7 +28,7 @@ public:
   inline bool
   empty() const
   {
-    return impl_.size() == 0;
+    return impl_.empty();
   }
 
   inline size_t
@@ -69,7 +70,20 @@ public:
   inline void
   push_back(const value_type &val)
   {
-    impl_.push_back(val);
+    impl_.emplace_back(val);
+  }
+
+  inline void
+  push_back(value_type &&val)
+  {
+    impl_.emplace_back(std::move(val));
+  }
+
+  template <typename... Args>
+  inline void
+  emplace_back(Args &&... args)
+  {
+    impl_.emplace_back(std::forward<Args>(args)...);
   }
 
   inline void
@@ -78,6 +92,25 @@ public:
     impl_.remove(val);
   }
 
+  // removes every element for which pred returns true, in a single traversal
+  template <typename Predicate>
+  inline void
+  remove_if(Predicate pred)
+  {
+    impl_.remove_if(pred);
+  }
+
+  // removes every element equal to some value in the sorted range
+  // [first, last), in a single traversal
+  template <typename Iter>
+  inline void
+  remove_all(Iter first, Iter last)
+  {
+    impl_.remove_if([first, last](const value_type &v) {
+      return std::binary_search(first, last, v);
+    });
+  }
+
   inline iterator
   begin()
   {
@@ -90,24 +123,66 @@ public:
     return impl_.end();
   }
 
+  // a single remove_if() rather than a try_pop_front() per element, which
+  // would copy every value out in some policies
   inline void
   clear()
   {
-    for (;;) {
-      auto ret = try_pop_front();
-      if (!ret.second)
-        break;
-    }
+    impl_.remove_if([](const T &) { return true; });
   }
 
   // begin non-standard API
 
+  // invokes fn on each element. Depending on the implementation, fn may be
+  // called while locks are held, so it must not call back into the list.
+  // Unlike iterators, this does not need to allocate any per-traversal state
+  template <typename Function>
+  inline void
+  for_each(Function fn)
+  {
+    impl_.for_each(fn);
+  }
+
+  // refcount-free iteration, only available for implementations which
+  // support it (Impl::supports_raw_iteration). The caller must stay inside of
+  // an Impl::read_region for as long as a raw_iterator is in use
+  template <typename I = Impl>
+  inline typename I::raw_iterator
+  raw_begin()
+  {
+    return impl_.raw_begin();
+  }
+
+  template <typename I = Impl>
+  inline typename I::raw_iterator
+  raw_end()
+  {
+    return impl_.raw_end();
+  }
+
+  // the popped value is moved out of the list node, except in policies whose
+  // readers don't synchronize w/ pops (lock_free, lock_free_rcu and lazy),
+  // which copy it
   std::pair<bool, T>
   try_pop_front()
   {
     return impl_.try_pop_front();
   }
 
+  // the underlying implementation, for implementation specific
+  // functionality (ie statistics)
+  inline Impl &
+  impl()
+  {
+    return impl_;
+  }
+
+  inline const Impl &
+  impl() const
+  {
+    return impl_;
+  }
+
 private:
   Impl impl_;
 };
@@ -3,20 +3,27 @@
 #include <cassert>
 #include <memory>
 #include <iterator>
+#include <utility>
+#include <type_traits>
+#include <vector>
 
 #include "atomic_reference.hpp"
+#include "backoff.hpp"
 #include "macros.hpp"
+#include "util.hpp"
 
 namespace private_ {
 struct nop_scoper {
   template <typename T>
   inline void release(T *) const {}
+  template <typename T>
+  inline void release_batch(T *const *, size_t) const {}
 };
 }
 
 /**
- * Lock-free singly-linked list implemention, with configurable ref counting
- * and garbage collection policies
+ * Lock-free singly-linked list implemention, with configurable ref counting,
+ * garbage collection and contention backoff policies
  *
  * References returned by this implementation are guaranteed to be valid until
  * the element is removed from the list
@@ -24,7 +31,8 @@ struct nop_scoper {
 template <typename T,
           typename RefPtrLockImpl = spinlock,
           typename RefCountImpl = atomic_ref_counted,
-          typename ScopedImpl = private_::nop_scoper>
+          typename ScopedImpl = private_::nop_scoper,
+          typename BackoffImpl = no_backoff>
 class lock_free_impl {
 private:
 
@@ -38,8 +46,11 @@ private:
     node &operator=(const node &) = delete;
 
     node() : value_(), next_() {}
-    node(const T &value, const node_ptr &next)
-      : value_(value), next_(next) {}
+
+    // value_ is constructed in place from args
+    template <typename... Args>
+    explicit node(const node_ptr &next, Args &&... args)
+      : value_(std::forward<Args>(args)...), next_(next) {}
 
     ~node()
     {
@@ -114,11 +125,109 @@ private:
     ScopedImpl scoper_;
   };
 
+  // walks raw node pointers w/ acquire loads, so advancing costs no atomic
+  // RMWs. Does not pin the nodes it visits: the caller must hold a
+  // read_region open for as long as the iterator is in use
+  struct raw_iterator_ : public std::iterator<std::forward_iterator_tag, T> {
+    raw_iterator_() : node_() {}
+    explicit raw_iterator_(node *node) : node_(node) {}
+
+    typedef T value_type;
+
+    T &
+    operator*() const
+    {
+      // could return deleted value
+      return node_->value_;
+    }
+
+    T *
+    operator->() const
+    {
+      // could return deleted value
+      return &node_->value_;
+    }
+
+    bool
+    operator==(const raw_iterator_ &o) const
+    {
+      return node_ == o.node_;
+    }
+
+    bool
+    operator!=(const raw_iterator_ &o) const
+    {
+      return !operator==(o);
+    }
+
+    raw_iterator_ &
+    operator++()
+    {
+      node_ = next_unmarked(node_);
+      return *this;
+    }
+
+    raw_iterator_
+    operator++(int)
+    {
+      raw_iterator_ cur = *this;
+      ++(*this);
+      return cur;
+    }
+
+    static inline node *
+    next_unmarked(node *p)
+    {
+      do {
+        p = p->next_.get(std::memory_order_acquire);
+      } while (p && p->next_.get_mark(std::memory_order_acquire));
+      return p;
+    }
+
+    node *node_;
+  };
+
 public:
 
   typedef iterator_ iterator;
+  typedef raw_iterator_ raw_iterator;
+
+  // entering a read_region keeps every node reachable at that point from
+  // being reclaimed until the region is left
+  typedef ScopedImpl read_region;
+
+  // raw iteration is only safe if read_region actually defers reclamation
+  static const bool supports_raw_iteration =
+    !std::is_same<ScopedImpl, private_::nop_scoper>::value;
+
+  typedef BackoffImpl backoff_type;
+
+  // the places where an operation can fail and have to retry
+  enum retry_site {
+    RETRY_PUSH_BACK, // lost the race to link onto the tail
+    RETRY_STALE_TAIL, // tail_ pointed to a removed node
+    RETRY_POP_FRONT, // lost the race to mark the first node
+    RETRY_MARK, // a marking CAS failed due to a concurrent update
+    NRetrySites,
+  };
 
-  lock_free_impl() : head_(new node), tail_(head_) {}
+  static const char *
+  retry_site_name(retry_site site)
+  {
+    static const char *const names[NRetrySites] =
+      {"push_back", "stale_tail", "pop_front", "mark"};
+    return names[site];
+  }
+
+  // number of times an operation had to retry at site, over all threads.
+  // approximate while operations are in flight
+  uint64_t
+  retry_count(retry_site site) const
+  {
+    return retry_counts_.sum(site);
+  }
+
+  lock_free_impl() : head_(new node), tail_(head_), retry_counts_() {}
   ~lock_free_impl()
   {
     ScopedImpl scoper;
@@ -126,8 +235,10 @@ public:
     // no other mutators
     node_ptr cur = head_;
     while (cur) {
-      if (cur->next_.mark())
-        scoper.release(cur.get());
+      // nodes which are still linked were never released, even if they were
+      // marked by a remover
+      cur->next_.mark();
+      scoper.release(cur.get());
       cur = cur->next_;
     }
   }
@@ -152,21 +263,35 @@ public:
     return ret;
   }
 
+  // O(number of marked nodes at the front), which is usually O(1)
+  bool
+  empty() const
+  {
+    ScopedImpl scoper UNUSED;
+    for (node_ptr p = head_->next_; p; p = p->next_)
+      if (!p->is_marked())
+        return false;
+    return true;
+  }
+
   T &
   front()
   {
   retry:
-    ScopedImpl scoper UNUSED;
+    ScopedImpl scoper;
     assert(!head_->is_marked());
     node_ptr p = head_->next_;
     assert(p);
-    if (p->is_marked())
-      // XXX: reap p for garbage collection
+    if (p->is_marked()) {
+      // its remover may have lost the race to unlink it
+      unlink(head_, p, scoper);
       goto retry;
+    }
     T &ref = p->value_;
-    if (p->is_marked())
-      // XXX: reap p for garbage collection
+    if (p->is_marked()) {
+      unlink(head_, p, scoper);
       goto retry;
+    }
     // we have stability on a reference
     if (!p->next_ && tail_ != p)
       tail_ = p;
@@ -193,14 +318,12 @@ public:
         goto retry;
     }
     if (tail->is_marked()) { // hopefully rare
-      // XXX: reap p for garbage collection
       fix_tail_pointer_from_head();
       goto retry;
     }
     tail_ = tail;
     T &ref = tail->value_;
     if (tail->is_marked()) { // see above
-      // XXX: reap p for garbage collection
       fix_tail_pointer_from_head();
       goto retry;
     }
@@ -217,31 +340,36 @@ public:
   void
   pop_front()
   {
+    BackoffImpl backoff;
   retry:
     ScopedImpl scoper;
     assert(!head_->is_marked());
     node_ptr cur = head_->next_;
     assert(cur);
 
-    if (!cur->next_.mark())
-      // was concurrently deleted
+    if (!mark(cur, backoff)) {
+      // was concurrently deleted, help unlink it
+      unlink(head_, cur, scoper);
+      on_retry(backoff, RETRY_POP_FRONT);
       goto retry;
+    }
 
-    // we don't need to CAS the prev ptr here, because we know that the
-    // sentinel node will never be deleted (that is, the first node of a list
-    // will *always* be the first node)
-    head_->next_ = cur->next_; // semantics of assign() do not copy marked bits
+    // the sentinel node is never deleted, so this can only fail if a
+    // concurrent operation already unlinked (and released) cur for us
+    unlink(head_, cur, scoper);
     if (!cur->next_ && tail_ != head_)
       tail_ = head_;
-    assert(cur->is_marked());
-    scoper.release(cur.get());
   }
 
+  template <typename... Args>
   void
-  push_back(const T &val)
+  emplace_back(Args &&... args)
   {
+    // the value is constructed once, up front; retries re-use the same node
+    node_ptr n(new node(node_ptr(), std::forward<Args>(args)...));
+    BackoffImpl backoff;
   retry:
-    ScopedImpl scoper;
+    ScopedImpl scoper UNUSED;
     assert(!head_->is_marked());
     node_ptr tail = tail_;
     assert(tail);
@@ -252,13 +380,12 @@ public:
     }
     if (tail->is_marked()) { // hopefully rare
       fix_tail_pointer_from_head();
+      on_retry(backoff, RETRY_STALE_TAIL);
       goto retry;
     }
-    node_ptr n(new node(val, node_ptr()));
     if (!tail->next_.compare_exchange_strong(node_ptr(), n)) {
-      bool ret = n->next_.mark(); // be pedantic
-      if (!ret) assert(false);
-      scoper.release(n.get());
+      // n was never published, so it is safe to re-use it
+      on_retry(backoff, RETRY_PUSH_BACK);
       goto retry;
     }
     tail_ = n;
@@ -266,37 +393,60 @@ public:
 
   inline void
   remove(const T &val)
+  {
+    remove_if([&val](const T &v) { return v == val; });
+  }
+
+  // Runs of consecutive matching nodes are marked first, and then unlinked
+  // together w/ a single CAS on the predecessor of the run. Everything we
+  // unlinked is handed to the scoper in one batch at the end.
+  template <typename Predicate>
+  void
+  remove_if(Predicate pred)
   {
     ScopedImpl scoper;
+    std::vector<node *> unlinked;
     node_ptr prev = head_;
-    node_ptr p = head_->next_, *pp = &head_->next_;
+    node_ptr p = head_->next_;
     while (p) {
-      if (p->value_ == val) {
-        // mark removed
-        if (p->next_.mark()) {
-          // try to unlink- ignore success value
-          if (pp->compare_exchange_strong(p, p->next_)) {
-            // successful unlink, report
-            assert(p->is_marked());
-            scoper.release(p.get());
-          }
-          if (!p->next_)
-            tail_ = prev;
-        }
-        // in any case, advance the current ptr, but keep the
-        // prev ptr the same
-        p = p->next_;
-      } else {
+      if (!p->is_marked() && !pred(p->value_)) {
         prev = p;
-        pp = &p->next_;
         p = p->next_;
+        continue;
+      }
+      if (!p->next_.mark()) {
+        // concurrently removed- help unlink it, and advance the current ptr,
+        // but keep the prev ptr the same
+        node_ptr next = p->next_;
+        unlink(prev, p, scoper);
+        p = next;
+        continue;
+      }
+      // marked nodes cannot have their next ptrs changed, so the run stays
+      // intact until we unlink it
+      const size_t run_begin = unlinked.size();
+      const node_ptr first = p;
+      do {
+        unlinked.push_back(p.get());
+        p = p->next_;
+      } while (p && pred(p->value_) && p->next_.mark());
+      if (prev->next_.compare_exchange_strong(first, p)) {
+        if (!p)
+          tail_ = prev;
+      } else {
+        // lost the race on prev, so the run stays linked (but marked) until
+        // later traversals unlink it node by node
+        unlinked.resize(run_begin);
       }
     }
+    if (!unlinked.empty())
+      scoper.release_batch(unlinked.data(), unlinked.size());
   }
 
   std::pair<bool, T>
   try_pop_front()
   {
+    BackoffImpl backoff;
   retry:
     ScopedImpl scoper;
     assert(!head_->is_marked());
@@ -305,17 +455,32 @@ public:
     if (unlikely(!cur))
       return std::make_pair(false, T());
 
-    if (!cur->next_.mark())
-      // was concurrently deleted
+    if (!mark(cur, backoff)) {
+      // was concurrently deleted, help unlink it
+      unlink(head_, cur, scoper);
+      on_retry(backoff, RETRY_POP_FRONT);
       goto retry;
+    }
 
-    T t = cur->value_;
-    head_->next_ = cur->next_; // semantics of assign() do not copy marked bits
+    // we are the unique marker of cur, but readers (iterators, raw
+    // iterators, references from front()/back()) don't synchronize w/ us and
+    // may still be reading its value, so it is copied rather than moved out
+    T t(cur->value_);
+    unlink(head_, cur, scoper); // see pop_front()
     if (!cur->next_ && tail_ != head_)
       tail_ = head_;
-    assert(cur->is_marked());
-    scoper.release(cur.get());
-    return std::make_pair(true, t);
+    return std::make_pair(true, std::move(t));
+  }
+
+  // Invokes fn on every element which is not marked removed. If the scoper
+  // defers reclamation, the traversal uses raw pointers inside of a single
+  // region, otherwise it pays for a reference count per node.
+  template <typename Function>
+  void
+  for_each(Function fn)
+  {
+    ScopedImpl scoper UNUSED;
+    for_each(fn, std::integral_constant<bool, supports_raw_iteration>());
   }
 
   iterator
@@ -331,19 +496,91 @@ public:
     return iterator_(node_ptr());
   }
 
+  // must be called (and the result used) from within a read_region
+  raw_iterator
+  raw_begin()
+  {
+    static_assert(supports_raw_iteration,
+                  "raw iteration requires deferred reclamation");
+    return raw_iterator_(raw_iterator_::next_unmarked(head_.get()));
+  }
+
+  raw_iterator
+  raw_end()
+  {
+    return raw_iterator_();
+  }
+
 private:
-  // relatively expensive, should be avoided
+  template <typename Function>
+  inline void
+  for_each(Function &fn, std::true_type)
+  {
+    for (node *p = raw_iterator_::next_unmarked(head_.get());
+         p; p = raw_iterator_::next_unmarked(p))
+      fn(p->value_);
+  }
+
+  template <typename Function>
+  inline void
+  for_each(Function &fn, std::false_type)
+  {
+    for (node_ptr p = head_->next_; p; p = p->next_)
+      if (!p->is_marked())
+        fn(p->value_);
+  }
+
+  inline void
+  on_retry(BackoffImpl &backoff, retry_site site)
+  {
+    retry_counts_.add(site, 1);
+    backoff.fail();
+  }
+
+  // marks p, backing off whenever the marking CAS fails
+  inline bool
+  mark(const node_ptr &p, BackoffImpl &backoff)
+  {
+    return p->next_.mark([this, &backoff]() {
+      on_retry(backoff, RETRY_MARK);
+    });
+  }
+
+  // Unlinks p, which must be marked, from behind prev. Fails if prev no
+  // longer points to p, or was itself marked. Nodes are released by whoever
+  // unlinks them, so that a marked node which its remover failed to unlink
+  // (eg because its prev ptr was removed concurrently) is released exactly
+  // once, by whichever traversal comes across it next.
+  inline bool
+  unlink(const node_ptr &prev, const node_ptr &p, const ScopedImpl &scoper)
+  {
+    assert(p->is_marked());
+    if (!prev->next_.compare_exchange_strong(p, p->next_))
+      return false;
+    scoper.release(p.get());
+    return true;
+  }
+
+  // relatively expensive, should be avoided. unlinks the marked nodes along
+  // the way, since nothing can be appended to a marked last node
   void
-  fix_tail_pointer_from_head() const
+  fix_tail_pointer_from_head()
   {
-    node_ptr cur = head_->next_;
+    ScopedImpl scoper;
     node_ptr prev = head_;
+    node_ptr cur = head_->next_;
     while (cur) {
+      if (cur->is_marked() && unlink(prev, cur, scoper)) {
+        cur = prev->next_;
+        continue;
+      }
       prev = cur;
       cur = cur->next_;
     }
     assert(prev);
     tail_ = prev;
   }
+
+  sharded_counters<uint64_t, NRetrySites> retry_counts_;
 };
 
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "asm.hpp"
+#include "macros.hpp"
+#include "util.hpp"
+
+/**
+ * Lock contention profiling, enabled at compile time w/ -DLOCK_PROFILING
+ * (make LOCK_PROFILING=1).
+ *
+ * A lock declared as site_lock<LockImpl, Site> records, for its site: the
+ * number of acquisitions, of failed attempts (a try_lock() which failed, or a
+ * lock() which couldn't take the lock right away), of spin iterations spent
+ * waiting, and the number of cycles the lock was held for. Site is a tag type
+ * w/ a static name(), declared w/ LOCK_SITE(). Every lock declared w/ the
+ * same site shares its counters, eg all the per-node locks of all lists.
+ *
+ * Spins are counted by the lock implementations themselves: their wait loops
+ * pause w/ lock_profile::spin(), which also bumps a thread-local counter that
+ * site_lock samples around lock().
+ *
+ * W/o LOCK_PROFILING, site_lock<LockImpl, Site> is LockImpl, and
+ * lock_profile::spin() is nop_pause(), so the locks compile down to the
+ * uninstrumented code.
+ */
+
+#define LOCK_SITE(tag, str) \
+  struct tag { static const char *name() { return str; } }
+
+class lock_profile {
+public:
+  enum counter {
+    ACQUISITIONS,
+    FAILED,
+    SPINS,
+    HOLD_CYCLES,
+    NCOUNTERS,
+  };
+
+  // the counters of a single site. sites are never destroyed
+  class site {
+  public:
+    explicit site(const char *name) : name_(name), counters_()
+    {
+      registry &r = get_registry();
+      std::lock_guard<std::mutex> l(r.mutex_);
+      r.sites_.push_back(this);
+    }
+
+    site(const site &) = delete;
+    site &operator=(const site &) = delete;
+
+    inline void
+    add(counter c, uint64_t delta)
+    {
+      counters_.add(c, delta);
+    }
+
+    inline uint64_t
+    get(counter c) const
+    {
+      return counters_.sum(c);
+    }
+
+    inline const char *
+    name() const
+    {
+      return name_;
+    }
+
+  private:
+    const char *name_;
+    sharded_counters<uint64_t, NCOUNTERS> counters_;
+  };
+
+  static inline bool
+  enabled()
+  {
+#ifdef LOCK_PROFILING
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // to be called once per iteration of a lock's wait loop, instead of
+  // nop_pause()
+  static inline void
+  spin()
+  {
+    nop_pause();
+#ifdef LOCK_PROFILING
+    tl_spins()++;
+#endif
+  }
+
+  // spins of the calling thread, so far
+  static inline uint64_t &
+  tl_spins()
+  {
+    static __thread uint64_t n = 0;
+    return n;
+  }
+
+  typedef std::pair<std::string, std::vector<uint64_t>> site_totals;
+
+  // the counters of every site, hottest (most failed attempts) first. sites
+  // of the same name are summed up
+  static std::vector<site_totals>
+  totals()
+  {
+    std::map<std::string, std::vector<uint64_t>> totals;
+    {
+      registry &r = get_registry();
+      std::lock_guard<std::mutex> l(r.mutex_);
+      for (site *s : r.sites_) {
+        std::vector<uint64_t> &t = totals[s->name()];
+        t.resize(NCOUNTERS, 0);
+        for (size_t c = 0; c < NCOUNTERS; c++)
+          t[c] += s->get(counter(c));
+      }
+    }
+    std::vector<site_totals> rows(totals.begin(), totals.end());
+    std::sort(rows.begin(), rows.end(),
+        [](const site_totals &a, const site_totals &b) {
+          return a.second[FAILED] > b.second[FAILED];
+        });
+    return rows;
+  }
+
+  // prints the totals() of every site which was used
+  static void
+  print(std::ostream &o)
+  {
+    const std::streamsize precision = o.precision();
+    o << "lock sites:" << std::endl;
+    for (auto &row : totals()) {
+      const std::vector<uint64_t> &t = row.second;
+      if (!t[ACQUISITIONS])
+        continue;
+      const double nacq = t[ACQUISITIONS];
+      o << "  " << row.first << ": "
+        << t[ACQUISITIONS] << " acquisitions, "
+        << t[FAILED] << " failed attempts ("
+        << std::setprecision(3) << (100.0 * t[FAILED] / nacq) << "%), "
+        << t[SPINS] << " spins, "
+        << "avg hold " << uint64_t(t[HOLD_CYCLES] / nacq) << " cycles"
+        << std::endl;
+    }
+    o.precision(precision);
+  }
+
+private:
+  struct registry {
+    std::mutex mutex_;
+    std::vector<site *> sites_;
+  };
+
+  static registry &
+  get_registry()
+  {
+    static registry r;
+    return r;
+  }
+};
+
+// LockImpl w/ contention counters, attributed to Site (see above)
+//
+// implements Lockable concept (C++11)
+template <typename LockImpl, typename Site>
+class profiled_lock {
+public:
+  profiled_lock() : impl_(), hold_start_(0) {}
+
+  // non-copyable/non-movable
+  profiled_lock(const profiled_lock &) = delete;
+  profiled_lock(profiled_lock &&) = delete;
+  profiled_lock &operator=(const profiled_lock &) = delete;
+
+  inline void
+  lock()
+  {
+    if (likely(impl_.try_lock())) {
+      acquired();
+      return;
+    }
+    lock_profile::site &s = stats();
+    s.add(lock_profile::FAILED, 1);
+    const uint64_t spins0 = lock_profile::tl_spins();
+    impl_.lock();
+    s.add(lock_profile::SPINS, lock_profile::tl_spins() - spins0);
+    acquired();
+  }
+
+  inline void
+  unlock()
+  {
+    const uint64_t held = rdtsc() - hold_start_;
+    impl_.unlock();
+    stats().add(lock_profile::HOLD_CYCLES, held);
+  }
+
+  inline bool
+  try_lock()
+  {
+    if (!impl_.try_lock()) {
+      stats().add(lock_profile::FAILED, 1);
+      return false;
+    }
+    acquired();
+    return true;
+  }
+
+private:
+  inline void
+  acquired()
+  {
+    stats().add(lock_profile::ACQUISITIONS, 1);
+    hold_start_ = rdtsc();
+  }
+
+  static lock_profile::site &
+  stats()
+  {
+    static lock_profile::site s(Site::name());
+    return s;
+  }
+
+  LockImpl impl_;
+  uint64_t hold_start_; // only accessed by the holder
+};
+
+// locks which don't lock anything can opt out of profiling by specializing
+// this
+template <typename LockImpl, typename Site>
+struct site_lock_type {
+#ifdef LOCK_PROFILING
+  typedef profiled_lock<LockImpl, Site> type;
+#else
+  typedef LockImpl type;
+#endif
+};
+
+template <typename LockImpl, typename Site>
+using site_lock = typename site_lock_type<LockImpl, Site>::type;
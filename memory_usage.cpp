@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdio>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef USE_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#endif
+
+#include "memory_usage.hpp"
+#include "rcu.hpp"
+
+// mallinfo2() replaced mallinfo(), whose fields are ints (and so wrap
+// around past 2GB)
+#if !defined(USE_JEMALLOC) && !defined(USE_TCMALLOC) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+#define MEMORY_USAGE_MALLINFO2
+#endif
+#endif
+
+memory_usage
+memory_usage::read()
+{
+  memory_usage m = memory_usage();
+  read_allocator(m);
+  read_rss(m);
+  m.rcu_pending = rcu::pending();
+  return m;
+}
+
+bool
+memory_usage::has_live_bytes()
+{
+#if defined(USE_JEMALLOC) || defined(MEMORY_USAGE_MALLINFO2)
+  return true;
+#else
+  return false;
+#endif
+}
+
+const char *
+memory_usage::allocator_name()
+{
+#if defined(USE_JEMALLOC)
+  return "jemalloc";
+#elif defined(USE_TCMALLOC)
+  return "tcmalloc";
+#else
+  return "libc";
+#endif
+}
+
+#ifdef USE_JEMALLOC
+// reads a size_t statistic, leaving v alone if jemalloc doesn't know it
+static void
+read_jemalloc_stat(const char *name, uint64_t &v)
+{
+  size_t s = 0;
+  size_t len = sizeof(s);
+  if (!mallctl(name, &s, &len, nullptr, 0))
+    v = s;
+}
+#endif
+
+void
+memory_usage::read_allocator(memory_usage &m)
+{
+#if defined(USE_JEMALLOC)
+  // jemalloc's statistics are cached, and only refreshed by bumping the epoch
+  uint64_t epoch = 1;
+  size_t len = sizeof(epoch);
+  mallctl("epoch", &epoch, &len, &epoch, len);
+  read_jemalloc_stat("stats.allocated", m.live_bytes);
+  read_jemalloc_stat("stats.active", m.active_bytes);
+  read_jemalloc_stat("stats.mapped", m.mapped_bytes);
+#elif defined(MEMORY_USAGE_MALLINFO2)
+  const struct mallinfo2 mi = mallinfo2();
+  m.live_bytes = mi.uordblks + mi.hblkhd; // incl. mmap()-ed chunks
+#endif
+}
+
+void
+memory_usage::read_rss(memory_usage &m)
+{
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    unsigned long size = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) == 2)
+      m.rss_bytes = resident * page_size;
+    fclose(f);
+  }
+  struct rusage ru;
+  if (!getrusage(RUSAGE_SELF, &ru))
+    m.peak_rss_bytes = uint64_t(ru.ru_maxrss) * 1024; // in KB on linux
+  // the kernel only updates the high-water mark lazily
+  m.peak_rss_bytes = std::max(m.peak_rss_bytes, m.rss_bytes);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * A snapshot of the process' memory usage, cheap enough to take every few ms.
+ *
+ * Live bytes are what the allocator has handed out and not gotten back yet:
+ * jemalloc's stats.allocated w/ USE_JEMALLOC, or glibc's mallinfo2() (which
+ * briefly locks every arena) otherwise. Under allocators which can't report
+ * them (eg tcmalloc), they are always 0, and has_live_bytes() is false.
+ *
+ * RSS is read from /proc/self/statm, and the peak RSS from getrusage().
+ */
+class memory_usage {
+public:
+  uint64_t live_bytes;
+  uint64_t rss_bytes;
+  uint64_t peak_rss_bytes;
+
+  // jemalloc only: bytes in pages backing live allocations, and bytes mapped
+  // by the allocator. 0 otherwise
+  uint64_t active_bytes;
+  uint64_t mapped_bytes;
+
+  // objects freed through RCU, which are waiting for a grace period
+  uint64_t rcu_pending;
+
+  static memory_usage read();
+
+  static bool has_live_bytes();
+  static const char *allocator_name();
+
+private:
+  static void read_allocator(memory_usage &m);
+  static void read_rss(memory_usage &m);
+};
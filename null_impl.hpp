@@ -0,0 +1,153 @@
+#pragma once
+
+#include <iterator>
+#include <utility>
+
+/**
+ * A list which holds nothing, and whose operations do (next to) nothing: it
+ * is always empty, except that front() and back() return a dummy value (so
+ * that workloads which expect a non-empty list keep running), and appended
+ * values are dropped.
+ *
+ * Not meant for use, but as a baseline for the benchmarks: its throughput is
+ * what the benchmark harness itself (the op loop, latency sampling, value
+ * construction etc) caps every policy at. The time per op it takes can be
+ * subtracted from that of a real policy, to tell the cost of the policy's
+ * operations alone.
+ *
+ * References returned by this implementation are to the dummy value, which
+ * stays valid for the lifetime of the list
+ */
+template <typename T>
+class null_impl {
+private:
+
+  struct iterator_ : public std::iterator<std::forward_iterator_tag, T> {
+    T &
+    operator*() const
+    {
+      // only ever at the end
+      __builtin_unreachable();
+    }
+
+    T *
+    operator->() const
+    {
+      __builtin_unreachable();
+    }
+
+    bool
+    operator==(const iterator_ &o) const
+    {
+      return true;
+    }
+
+    bool
+    operator!=(const iterator_ &o) const
+    {
+      return false;
+    }
+
+    iterator_ &
+    operator++()
+    {
+      return *this;
+    }
+
+    iterator_
+    operator++(int)
+    {
+      return *this;
+    }
+  };
+
+  T dummy_;
+
+public:
+
+  typedef iterator_ iterator;
+
+  null_impl() : dummy_() {}
+
+  inline size_t
+  size() const
+  {
+    return 0;
+  }
+
+  inline bool
+  empty() const
+  {
+    return true;
+  }
+
+  inline T &
+  front()
+  {
+    return dummy_;
+  }
+
+  inline const T &
+  front() const
+  {
+    return dummy_;
+  }
+
+  inline T &
+  back()
+  {
+    return dummy_;
+  }
+
+  inline const T &
+  back() const
+  {
+    return dummy_;
+  }
+
+  inline void
+  pop_front()
+  {
+  }
+
+  template <typename... Args>
+  inline void
+  emplace_back(Args &&... args)
+  {
+  }
+
+  inline void
+  remove(const T &val)
+  {
+  }
+
+  template <typename Predicate>
+  inline void
+  remove_if(Predicate pred)
+  {
+  }
+
+  inline std::pair<bool, T>
+  try_pop_front()
+  {
+    return std::make_pair(false, T());
+  }
+
+  template <typename Function>
+  inline void
+  for_each(Function fn)
+  {
+  }
+
+  inline iterator
+  begin()
+  {
+    return iterator_();
+  }
+
+  inline iterator
+  end()
+  {
+    return iterator_();
+  }
+};
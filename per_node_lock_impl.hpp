@@ -2,42 +2,68 @@
 
 #include <cassert>
 #include <memory>
+#include <mutex>
 #include <iterator>
+#include <utility>
 
 // toggle between spinlock implementation or std::mutex
 #define USE_SPINLOCK
 
 #ifdef USE_SPINLOCK
 #include "spinlock.hpp"
-#else
-#include <mutex>
 #endif
 
+#include "lock_profile.hpp"
 #include "macros.hpp"
+#include "util.hpp"
+
+namespace private_ {
+#ifdef USE_SPINLOCK
+  typedef spinlock per_node_lock_type;
+#else
+  typedef std::mutex per_node_lock_type;
+#endif
+
+  LOCK_SITE(per_node_lock_node_site, "per_node_lock_impl::node::mutex_");
+  LOCK_SITE(per_node_lock_tail_site, "per_node_lock_impl::tail_ptr_mutex_");
+}
 
 /**
- * Standard singly-linked list with a per-node locks for protection, and
- * standard reference counting. Hand over hand locking is used to
- * traverse/mutate the list.
+ * Standard singly-linked list with a per-node locks for protection. Hand over
+ * hand locking is used to traverse/mutate the list.
+ *
+ * Nodes are owned by the list, and are not reference counted: a node can
+ * only be unlinked by a thread holding the locks on both it and its
+ * predecessor, and every traversal (including iterators) holds the lock on
+ * the node it is at, before letting go of its predecessor. So a node which a
+ * traversal can reach is never deleted out from under it, and once the
+ * remover releases the unlinked node's lock, nobody else can be holding (or
+ * waiting for) it, so it can be deleted right away. Traversals are therefore
+ * plain pointer chasing.
+ *
+ * The number of elements is kept in sharded counters, so that size() is O(1)
+ * w/o making every mutation contend on a single counter. size() is therefore
+ * only approximate while mutations are in flight.
+ *
+ * Every append goes through the lock on the tail pointer, which can be
+ * replaced w/ TailLockImpl (eg a queue lock, for fair handoff between
+ * producers).
  *
  * References returned by this implementation are guaranteed to be valid until
  * the element is removed from the list
  */
-template <typename T>
+template <typename T,
+          typename TailLockImpl = private_::per_node_lock_type>
 class per_node_lock_impl {
 private:
 
-  struct node;
-
-#ifdef USE_SPINLOCK
-  typedef spinlock lock_type;
-#else
-  typedef std::mutex lock_type;
-#endif
+  typedef site_lock<private_::per_node_lock_type,
+                    private_::per_node_lock_node_site> lock_type;
+  typedef site_lock<TailLockImpl, private_::per_node_lock_tail_site>
+    tail_lock_type;
 
   typedef std::unique_lock<lock_type> unique_lock;
   typedef std::shared_ptr<unique_lock> unique_lock_ptr;
-  typedef std::shared_ptr<node> node_ptr;
 
   struct node {
     // non-copyable
@@ -46,29 +72,30 @@ private:
     node &operator=(const node &) = delete;
 
     node() : value_(), next_() {}
-    node(const T &value, const node_ptr &next)
-      : value_(value), next_(next) {}
+
+    // value_ is constructed in place from args
+    template <typename... Args>
+    explicit node(node *next, Args &&... args)
+      : value_(std::forward<Args>(args)...), next_(next) {}
 
     // Note: mutex_ must be held in order to access next_
     mutable lock_type mutex_;
     T value_;
-    node_ptr next_;
+    node *next_;
   };
 
-  // NB: multiple threads mutating the same shared_ptr instance
-  // is subject to data races- however, since head_ is not mutated
-  // (only read) by multiple threads, we can access it w/o a lock
-  node_ptr head_; // head_ points to a sentinel beginning node
+  node *const head_; // head_ points to a sentinel beginning node
+
+  // guards tail_
+  tail_lock_type tail_ptr_mutex_;
+  node *tail_;
 
-  // we do, however, need a mutex to guard the tail_ shared_ptr instance
-  lock_type tail_ptr_mutex_;
-  node_ptr tail_;
+  // +1 for every insertion, -1 for every removal, after the fact
+  sharded_counters<int64_t> size_;
 
   struct iterator_ : public std::iterator<std::forward_iterator_tag, T> {
     iterator_() : lock_(), node_() {}
-    iterator_(const unique_lock_ptr &lock, const node_ptr &node)
-      : lock_(lock), node_(node) {}
-    iterator_(unique_lock_ptr &&lock, const node_ptr &node)
+    iterator_(unique_lock_ptr &&lock, node *node)
       : lock_(std::move(lock)), node_(node) {}
 
     T &
@@ -98,13 +125,21 @@ private:
     iterator_ &
     operator++()
     {
-      if (node_->next_) {
-        unique_lock_ptr l(std::make_shared<unique_lock>(node_->next_->mutex_));
-        node_ = node_->next_;
-        lock_ = l;
-      } else {
-        node_.reset();
+      node *next = node_->next_;
+      if (!next) {
+        node_ = nullptr;
         lock_.reset();
+      } else if (lock_.use_count() == 1) {
+        // we are the only owner of lock_, so instead of allocating a new
+        // lock, lock next and swap it into lock_ (which hands the lock on
+        // node_ over to l, to be released when it goes out of scope)
+        unique_lock l(next->mutex_);
+        lock_->swap(l);
+        node_ = next;
+      } else {
+        // lock_ is shared w/ a copy of this iterator which still needs it
+        lock_ = std::make_shared<unique_lock>(next->mutex_);
+        node_ = next;
       }
       return *this;
     }
@@ -117,55 +152,53 @@ private:
       return cur;
     }
 
+    // lock_ holds node_->mutex_, which keeps node_ from being unlinked
     unique_lock_ptr lock_;
-    node_ptr node_;
+    node *node_;
   };
 
 public:
 
   typedef iterator_ iterator;
 
-  per_node_lock_impl() : head_(new node), tail_(head_) {}
+  per_node_lock_impl()
+    : head_(new node), tail_ptr_mutex_(), tail_(head_), size_() {}
 
-  size_t
-  size() const
+  ~per_node_lock_impl()
   {
-    size_t ret = 0;
-    node_ptr prev = head_;
-    head_->mutex_.lock();
-    node_ptr cur = head_->next_;
+    // can do this non-thread safe, since we know there are no other users
+    node *cur = head_;
     while (cur) {
-      // NB: hand-over-hand locking ensures that cur doesn't become a deleted
-      // object (otherwise, if we released prev's lock before acquiring cur's
-      // lock, cur could be deleted by another thread).
-      //
-      // This, however, isn't necessarily a bad thing: by creating a node_ptr
-      // pointing to cur, we do ensure that cur won't be deleted, even if we
-      // were to release the lock on prev. Seeing as how size() is not a
-      // linearizable operation regardless of whether or not we do
-      // hand-over-hand locking (it's really only an approximating if there are
-      // concurrent mutations), then it might be OK to include deleted elements
-      // in the size count.
-      cur->mutex_.lock();
-      prev->mutex_.unlock();
-      ret++;
-      prev = cur;
-      cur = cur->next_;
+      node *next = cur->next_;
+      delete cur;
+      cur = next;
     }
-    prev->mutex_.unlock();
-    return ret;
+  }
+
+  inline size_t
+  size() const
+  {
+    // a removal can be counted before the insertion it undoes
+    const int64_t n = size_.sum(0);
+    return n > 0 ? n : 0;
+  }
+
+  inline bool
+  empty() const
+  {
+    unique_lock l(head_->mutex_);
+    return !head_->next_;
   }
 
   inline T &
   front()
   {
     // NB: holding onto head_->mutex_ is enough to ensure that first is not
-    // deleted concurrently (the ref-count is also enough)
+    // deleted concurrently
     unique_lock l(head_->mutex_);
-    node_ptr first = head_->next_;
+    node *first = head_->next_;
     assert(first);
     return first->value_;
-
   }
 
   inline const T &
@@ -177,7 +210,8 @@ public:
   inline T &
   back()
   {
-    unique_lock l(tail_ptr_mutex_); // guards tail from being removed
+    // guards tail from being removed
+    std::unique_lock<tail_lock_type> l(tail_ptr_mutex_);
     assert(head_ != tail_);
     assert(!tail_->next_);
     return tail_->value_;
@@ -192,58 +226,53 @@ public:
   void
   pop_front()
   {
-  retry:
-    unique_lock l(head_->mutex_);
-    node_ptr first = head_->next_;
-    assert(first);
-    unique_lock l0(first->mutex_);
-    bool is_tail = !first->next_;
-    if (is_tail) {
-      l0.unlock();
-      tail_ptr_mutex_.lock();
-      l0.lock();
-      assert(head_->next_ == first);
-      if (first->next_)  {
-        // no longer tail, retry
-        tail_ptr_mutex_.unlock();
-        goto retry;
-      }
-      assert(tail_ == first);
-    }
-    head_->next_ = first->next_;
-    if (is_tail) {
-      tail_ = head_;
-      tail_ptr_mutex_.unlock();
-    }
+    bool ret UNUSED = pop_first([](T &) {});
+    assert(ret);
   }
 
+  template <typename... Args>
   void
-  push_back(const T &val)
+  emplace_back(Args &&... args)
   {
-    node_ptr n(std::make_shared<node>(val, nullptr));
-    unique_lock l(tail_ptr_mutex_);
+    node *n = new node(nullptr, std::forward<Args>(args)...);
+    std::unique_lock<tail_lock_type> l(tail_ptr_mutex_);
     unique_lock l1(tail_->mutex_);
     assert(!tail_->next_);
     tail_->next_ = n;
     tail_ = n;
+    l1.unlock();
+    l.unlock();
+    size_.add(0, 1);
   }
 
   inline void
   remove(const T &val)
   {
-    node_ptr prev = head_;
+    remove_if([&val](const T &v) { return v == val; });
+  }
+
+  template <typename Predicate>
+  void
+  remove_if(Predicate pred)
+  {
+    node *prev = head_;
     prev->mutex_.lock();
-    node_ptr cur = prev->next_;
+    node *cur = prev->next_;
     while (cur) {
       cur->mutex_.lock();
-      if (cur->value_ == val) {
+      if (pred(cur->value_)) {
         // unlink
         bool is_tail = !cur->next_;
         if (is_tail) {
           cur->mutex_.unlock();
           tail_ptr_mutex_.lock();
           cur->mutex_.lock();
-          assert(tail_ == cur);
+          // an append might have snuck in while cur was unlocked
+          is_tail = !cur->next_;
+          if (!is_tail)
+            tail_ptr_mutex_.unlock();
+          else
+            assert(tail_ == cur);
         }
         prev->next_ = cur->next_;
         if (is_tail) {
@@ -251,6 +280,8 @@ public:
           tail_ptr_mutex_.unlock();
         }
         cur->mutex_.unlock();
+        delete cur;
+        size_.add(0, -1);
         cur = prev->next_;
       } else {
         prev->mutex_.unlock();
@@ -263,14 +294,64 @@ public:
 
   std::pair<bool, T>
   try_pop_front()
+  {
+    T t;
+    if (!pop_first([&t](T &v) { t = std::move(v); }))
+      return std::make_pair(false, T());
+    return std::make_pair(true, std::move(t));
+  }
+
+  // Invokes fn on every element w/ hand-over-hand locking. Unlike iterators,
+  // this doesn't allocate. fn must not call back into the list.
+  template <typename Function>
+  void
+  for_each(Function fn)
+  {
+    node *prev = head_;
+    prev->mutex_.lock();
+    node *cur = prev->next_;
+    while (cur) {
+      cur->mutex_.lock();
+      prev->mutex_.unlock();
+      fn(cur->value_);
+      prev = cur;
+      cur = cur->next_;
+    }
+    prev->mutex_.unlock();
+  }
+
+  iterator
+  begin()
+  {
+    unique_lock l(head_->mutex_);
+    node *first = head_->next_;
+    if (first)
+      return iterator_(std::make_shared<unique_lock>(first->mutex_), first);
+    else
+      return iterator_();
+  }
+
+  iterator
+  end()
+  {
+    return iterator_();
+  }
+
+private:
+
+  // unlinks the first node, after handing its value to fn (while the node is
+  // still locked, so nobody else can observe the moved-from value). returns
+  // false if the list was empty
+  template <typename Function>
+  bool
+  pop_first(Function fn)
   {
   retry:
     unique_lock l(head_->mutex_);
-    node_ptr first = head_->next_;
+    node *first = head_->next_;
     if (unlikely(!first))
-      return std::make_pair(false, T());
+      return false;
     unique_lock l0(first->mutex_);
-    T t = first->value_;
     bool is_tail = !first->next_;
     if (is_tail) {
       l0.unlock();
@@ -284,29 +365,16 @@ public:
       }
       assert(tail_ == first);
     }
+    fn(first->value_);
     head_->next_ = first->next_;
     if (is_tail) {
       tail_ = head_;
       tail_ptr_mutex_.unlock();
     }
-    return std::make_pair(true, t);
-  }
-
-  iterator
-  begin()
-  {
-    unique_lock l(head_->mutex_);
-    if (head_->next_)
-      return iterator_(
-          std::move(std::make_shared<unique_lock>(head_->next_->mutex_)),
-          head_->next_);
-    else
-      return iterator_(unique_lock_ptr(), node_ptr());
-  }
-
-  iterator
-  end()
-  {
-    return iterator_(unique_lock_ptr(), node_ptr());
+    l0.unlock();
+    l.unlock();
+    delete first;
+    size_.add(0, -1);
+    return true;
   }
 };
@@ -0,0 +1,195 @@
+#include <cpuid.h>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf_counters.hpp"
+
+// loads which hit a line in another core's cache on the same socket, which was
+// modified (MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM, or .XSNP_FWD on newer cores).
+// the encoding is the same from haswell through ice lake
+static const uint64_t intel_hitm_raw_event = 0x04d2;
+
+static bool
+is_intel_core()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+    return false;
+  // "GenuineIntel"
+  if (ebx != 0x756e6547 || edx != 0x49656e69 || ecx != 0x6c65746e)
+    return false;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+  const unsigned int family = (eax >> 8) & 0xf;
+  const unsigned int model = ((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0);
+  if (family != 6)
+    return false;
+  // the big cores which intel_hitm_raw_event is known to work on. atom cores
+  // (eg goldmont, tremont) are family 6 too, and interleave w/ their model
+  // numbers, so this can't be a range
+  static const unsigned int models[] = {
+    0x3c, 0x3f, 0x45, 0x46,       // haswell
+    0x3d, 0x47, 0x4f, 0x56,       // broadwell
+    0x4e, 0x5e, 0x55,             // skylake (incl. cascade/cooper lake)
+    0x8e, 0x9e, 0xa5, 0xa6,       // kaby/coffee/whiskey/comet lake
+    0x66,                         // cannon lake
+    0x7d, 0x7e, 0x6a, 0x6c,       // ice lake
+  };
+  for (unsigned int m : models)
+    if (model == m)
+      return true;
+  return false;
+}
+
+// fills in type and config, or returns false if e can't be counted here
+static bool
+event_config(perf_counters::event e, uint32_t &type, uint64_t &config)
+{
+  switch (e) {
+  case perf_counters::CYCLES:
+    type = PERF_TYPE_HARDWARE;
+    config = PERF_COUNT_HW_CPU_CYCLES;
+    return true;
+  case perf_counters::INSTRUCTIONS:
+    type = PERF_TYPE_HARDWARE;
+    config = PERF_COUNT_HW_INSTRUCTIONS;
+    return true;
+  case perf_counters::LLC_MISSES:
+    type = PERF_TYPE_HARDWARE;
+    config = PERF_COUNT_HW_CACHE_MISSES;
+    return true;
+  case perf_counters::REMOTE_ACCESSES:
+    type = PERF_TYPE_HW_CACHE;
+    config = PERF_COUNT_HW_CACHE_NODE |
+             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    return true;
+  case perf_counters::HITM:
+    type = PERF_TYPE_RAW;
+    config = intel_hitm_raw_event;
+    return is_intel_core();
+  case perf_counters::TASK_CLOCK:
+    type = PERF_TYPE_SOFTWARE;
+    config = PERF_COUNT_SW_TASK_CLOCK;
+    return true;
+  case perf_counters::CONTEXT_SWITCHES:
+    type = PERF_TYPE_SOFTWARE;
+    config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+    return true;
+  case perf_counters::CPU_MIGRATIONS:
+    type = PERF_TYPE_SOFTWARE;
+    config = PERF_COUNT_SW_CPU_MIGRATIONS;
+    return true;
+  case perf_counters::PAGE_FAULTS:
+    type = PERF_TYPE_SOFTWARE;
+    config = PERF_COUNT_SW_PAGE_FAULTS;
+    return true;
+  default:
+    return false;
+  }
+}
+
+const char *
+perf_counters::event_name(event e)
+{
+  static const char *const names[NEvents] = {
+    "cycles", "instructions", "llc-misses", "remote-accesses", "hitm",
+    "task-clock-ns", "context-switches", "cpu-migrations", "page-faults",
+  };
+  return names[e];
+}
+
+perf_counters::perf_counters()
+  : fallback_start_()
+{
+  for (size_t i = 0; i < NEvents; i++) {
+    fds_[i] = -1;
+    has_[i] = false;
+    counts_[i] = 0;
+    uint32_t type = 0;
+    uint64_t config = 0;
+    if (!event_config(event(i), type, config))
+      continue;
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    // software events (eg context switches) happen in the kernel, so they
+    // can only be counted if perf_event_paranoid allows it. otherwise they
+    // fall back to getrusage()
+    attr.exclude_kernel = is_hardware(event(i));
+    attr.exclude_hv = 1;
+    attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // the calling thread, on any cpu
+    fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    has_[i] = fds_[i] >= 0;
+  }
+  // the fallbacks for software events
+  has_[TASK_CLOCK] = has_[CONTEXT_SWITCHES] = has_[PAGE_FAULTS] = true;
+}
+
+perf_counters::~perf_counters()
+{
+  for (size_t i = 0; i < NEvents; i++)
+    if (fds_[i] >= 0)
+      close(fds_[i]);
+}
+
+void
+perf_counters::start()
+{
+  fallback_start_ = read_fallback();
+  for (size_t i = 0; i < NEvents; i++)
+    if (fds_[i] >= 0)
+      ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void
+perf_counters::stop()
+{
+  for (size_t i = 0; i < NEvents; i++)
+    if (fds_[i] >= 0)
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+  const fallback f = read_fallback();
+  for (size_t i = 0; i < NEvents; i++) {
+    if (fds_[i] < 0)
+      continue;
+    // value, time enabled, time running
+    uint64_t v[3] = {0, 0, 0};
+    if (read(fds_[i], v, sizeof(v)) != ssize_t(sizeof(v)) || !v[2]) {
+      // never got scheduled onto a hardware counter
+      has_[i] = false;
+      continue;
+    }
+    counts_[i] = v[2] < v[1] ? uint64_t(double(v[0]) * v[1] / v[2]) : v[0];
+  }
+  if (fds_[TASK_CLOCK] < 0)
+    counts_[TASK_CLOCK] = f.task_clock_ns - fallback_start_.task_clock_ns;
+  if (fds_[CONTEXT_SWITCHES] < 0)
+    counts_[CONTEXT_SWITCHES] =
+      f.context_switches - fallback_start_.context_switches;
+  if (fds_[PAGE_FAULTS] < 0)
+    counts_[PAGE_FAULTS] = f.page_faults - fallback_start_.page_faults;
+}
+
+perf_counters::fallback
+perf_counters::read_fallback()
+{
+  fallback f = fallback();
+  struct timespec ts;
+  if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+    f.task_clock_ns = uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  struct rusage ru;
+  if (!getrusage(RUSAGE_THREAD, &ru)) {
+    f.context_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+    f.page_faults = ru.ru_minflt + ru.ru_majflt;
+  }
+  return f;
+}
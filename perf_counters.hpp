@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+/**
+ * Performance counters of the calling thread, read through perf_event_open().
+ *
+ * Hardware events only count user space, which is all that the default
+ * perf_event_paranoid (2) allows. Every event is opened on its own, so that
+ * events which the machine doesn't support (eg hardware events inside of
+ * most VMs) are simply missing, and has() is false for them. The task clock,
+ * context switches and page faults fall back to getrusage() and the thread's
+ * CPU clock if they can't be opened (eg because perf_event_paranoid doesn't
+ * allow counting in the kernel). Counts are scaled up if the kernel
+ * had to multiplex the hardware counters.
+ *
+ * The counters are opened by the constructor, which is relatively expensive
+ * (a syscall per event), and only start counting upon start().
+ */
+class perf_counters {
+public:
+  enum event {
+    // hardware
+    CYCLES,
+    INSTRUCTIONS,
+    LLC_MISSES,
+    REMOTE_ACCESSES, // accesses served by another NUMA node
+    HITM, // loads which hit a modified line in another core's cache (intel)
+    // software
+    TASK_CLOCK, // in ns
+    CONTEXT_SWITCHES,
+    CPU_MIGRATIONS,
+    PAGE_FAULTS,
+    NEvents,
+  };
+
+  static const char *event_name(event e);
+
+  static inline bool
+  is_hardware(event e)
+  {
+    return e < TASK_CLOCK;
+  }
+
+  perf_counters();
+  ~perf_counters();
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  void start();
+
+  // stops counting, after which count() holds the final counts
+  void stop();
+
+  inline bool
+  has(event e) const
+  {
+    return has_[e];
+  }
+
+  inline uint64_t
+  count(event e) const
+  {
+    return counts_[e];
+  }
+
+private:
+  // the values of the getrusage()/clock fallbacks, for events w/o an fd
+  struct fallback {
+    uint64_t task_clock_ns;
+    uint64_t context_switches;
+    uint64_t page_faults;
+  };
+
+  static fallback read_fallback();
+
+  int fds_[NEvents];
+  bool has_[NEvents];
+  uint64_t counts_[NEvents];
+  fallback fallback_start_;
+};
@@ -4,15 +4,47 @@
 #include "global_lock_impl.hpp"
 #include "per_node_lock_impl.hpp"
 #include "lock_free_impl.hpp"
+#include "lazy_list_impl.hpp"
+#include "two_lock_queue_impl.hpp"
+#include "null_impl.hpp"
 
 #include "rcu.hpp"
 #include "atomic_reference.hpp"
+#include "backoff.hpp"
+#include "queue_locks.hpp"
+#include "hybrid_lock.hpp"
+#include "cohort_lock.hpp"
 
 template <typename T>
 struct ll_policy {
   typedef global_lock_impl<T> global_lock;
+  typedef global_lock_impl<T, rwlock> global_rwlock;
+  typedef global_lock_impl<T, seqlock> global_seqlock;
   typedef per_node_lock_impl<T> per_node_lock;
   typedef lock_free_impl<T> lock_free;
   typedef lock_free_impl<T, nop_lock, nop_ref_counted, scoped_rcu_region>
           lock_free_rcu;
+  typedef lazy_list_impl<T> lazy;
+  typedef two_lock_queue_impl<T> two_lock_queue;
+  // no list at all, for measuring the overhead of the benchmarks
+  typedef null_impl<T> null;
+
+  // the policies w/ a pluggable lock: global_lock's lock, and per_node_lock's
+  // tail lock
+  template <typename LockImpl>
+  struct with_lock {
+    typedef global_lock_impl<T, LockImpl> global_lock;
+    typedef per_node_lock_impl<T, LockImpl> per_node_lock;
+  };
+
+  // the lock-free policies, w/ a backoff policy for their retry loops
+  template <typename BackoffImpl>
+  struct with_backoff {
+    typedef lock_free_impl<T, spinlock, atomic_ref_counted,
+                           private_::nop_scoper, BackoffImpl>
+            lock_free;
+    typedef lock_free_impl<T, nop_lock, nop_ref_counted,
+                           scoped_rcu_region, BackoffImpl>
+            lock_free_rcu;
+  };
 };
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "asm.hpp"
+#include "lock_profile.hpp"
+#include "macros.hpp"
+
+/**
+ * Queue locks: waiters enqueue themselves, and spin on a flag of their own
+ * (MCS) or of their predecessor (CLH), which only changes when the lock is
+ * handed to them. So a waiter spins in its own cache, the holder's unlock
+ * touches a single waiter's line, and the lock is granted in FIFO order.
+ *
+ * Both implement the Lockable concept (C++11). Since lock()/unlock() take no
+ * arguments, queue nodes come from a thread-local free list, and the holder
+ * remembers its node in the lock itself.
+ */
+
+namespace private_ {
+
+// Thread-local free list of Node, which must have a Node *pool_next_ member.
+// Nodes are cache line aligned (and padded), so that spinning on one never
+// interferes w/ another. They can be released by a different thread than the
+// one which allocated them.
+template <typename Node>
+class qnode_pool {
+public:
+  static Node *
+  alloc()
+  {
+    free_list &l = local();
+    Node *n = l.head_;
+    if (likely(n)) {
+      l.head_ = n->pool_next_;
+      return n;
+    }
+    void *p = nullptr;
+    if (posix_memalign(&p, CACHELINE_SIZE, sizeof(Node)))
+      throw std::bad_alloc();
+    return new (p) Node;
+  }
+
+  static void
+  release(Node *n)
+  {
+    free_list &l = local();
+    n->pool_next_ = l.head_;
+    l.head_ = n;
+  }
+
+  static void
+  destroy(Node *n)
+  {
+    n->~Node();
+    free(n);
+  }
+
+private:
+  struct free_list {
+    free_list() : head_(nullptr) {}
+    ~free_list()
+    {
+      while (head_) {
+        Node *next = head_->pool_next_;
+        destroy(head_);
+        head_ = next;
+      }
+    }
+    Node *head_;
+  };
+
+  static free_list &
+  local()
+  {
+    static thread_local free_list l;
+    return l;
+  }
+};
+
+}
+
+// Mellor-Crummey and Scott's queue lock. Every waiter spins on its own node,
+// which its predecessor links to, and clears when handing the lock over.
+class mcs_lock {
+public:
+  mcs_lock() : tail_(nullptr), holder_(nullptr) {}
+
+  // non-copyable/non-movable
+  mcs_lock(const mcs_lock &) = delete;
+  mcs_lock(mcs_lock &&) = delete;
+  mcs_lock &operator=(const mcs_lock &) = delete;
+
+  inline void
+  lock()
+  {
+    qnode *q = pool::alloc();
+    q->next_.store(nullptr, std::memory_order_relaxed);
+    q->locked_.store(true, std::memory_order_relaxed);
+    qnode *pred = tail_.exchange(q, std::memory_order_acq_rel);
+    if (pred) {
+      pred->next_.store(q, std::memory_order_release);
+      while (q->locked_.load(std::memory_order_acquire))
+        lock_profile::spin();
+    }
+    holder_ = q;
+  }
+
+  inline void
+  unlock()
+  {
+    qnode *q = holder_;
+    qnode *next = q->next_.load(std::memory_order_acquire);
+    if (!next) {
+      qnode *expected = q;
+      if (tail_.compare_exchange_strong(expected, nullptr,
+                                        std::memory_order_release)) {
+        pool::release(q);
+        return;
+      }
+      // a waiter has swapped itself in, but hasn't linked to q yet
+      while (!(next = q->next_.load(std::memory_order_acquire)))
+        nop_pause();
+    }
+    next->locked_.store(false, std::memory_order_release);
+    // the successor is done w/ q, since it linked to q before spinning
+    pool::release(q);
+  }
+
+  inline bool
+  try_lock()
+  {
+    if (tail_.load(std::memory_order_relaxed))
+      return false;
+    qnode *q = pool::alloc();
+    q->next_.store(nullptr, std::memory_order_relaxed);
+    qnode *expected = nullptr;
+    if (!tail_.compare_exchange_strong(expected, q,
+                                       std::memory_order_acq_rel)) {
+      pool::release(q);
+      return false;
+    }
+    holder_ = q;
+    return true;
+  }
+
+private:
+  struct qnode {
+    qnode() : next_(nullptr), locked_(false), pool_next_(nullptr) {}
+    std::atomic<qnode *> next_;
+    std::atomic<bool> locked_;
+    qnode *pool_next_;
+    CACHE_PADOUT;
+  } CACHE_ALIGNED;
+  typedef private_::qnode_pool<qnode> pool;
+
+  std::atomic<qnode *> tail_;
+  qnode *holder_; // only accessed by the holder
+};
+
+// Craig, Landin and Hagersten's queue lock. Every waiter spins on its
+// predecessor's node, which the predecessor clears when releasing the lock.
+// Unlike MCS, unlock() never waits for a successor, but nodes move from one
+// thread to the next: a thread which acquired the lock recycles its
+// predecessor's node upon unlock, and leaves its own node behind.
+class clh_lock {
+public:
+  clh_lock() : tail_(pool::alloc()), holder_(nullptr), holder_pred_(nullptr)
+  {
+    tail_.load(std::memory_order_relaxed)->locked_.store(
+        false, std::memory_order_relaxed);
+  }
+
+  ~clh_lock()
+  {
+    pool::destroy(tail_.load(std::memory_order_relaxed));
+  }
+
+  // non-copyable/non-movable
+  clh_lock(const clh_lock &) = delete;
+  clh_lock(clh_lock &&) = delete;
+  clh_lock &operator=(const clh_lock &) = delete;
+
+  inline void
+  lock()
+  {
+    qnode *q = pool::alloc();
+    q->locked_.store(true, std::memory_order_relaxed);
+    qnode *pred = tail_.exchange(q, std::memory_order_acq_rel);
+    while (pred->locked_.load(std::memory_order_acquire))
+      lock_profile::spin();
+    holder_ = q;
+    holder_pred_ = pred;
+  }
+
+  inline void
+  unlock()
+  {
+    qnode *pred = holder_pred_;
+    holder_->locked_.store(false, std::memory_order_release);
+    // nobody else can reach pred anymore
+    pool::release(pred);
+  }
+
+  // NB: the predecessor's node can be recycled and re-enqueued (locked) in
+  // between us checking it and swapping ourselves in. since there is no
+  // leaving a CLH queue once in it, we then wait for it like lock() does,
+  // which is rare and brief
+  inline bool
+  try_lock()
+  {
+    qnode *pred = tail_.load(std::memory_order_acquire);
+    if (pred->locked_.load(std::memory_order_acquire))
+      return false;
+    qnode *q = pool::alloc();
+    q->locked_.store(true, std::memory_order_relaxed);
+    if (!tail_.compare_exchange_strong(pred, q, std::memory_order_acq_rel)) {
+      pool::release(q);
+      return false;
+    }
+    while (pred->locked_.load(std::memory_order_acquire))
+      lock_profile::spin();
+    holder_ = q;
+    holder_pred_ = pred;
+    return true;
+  }
+
+private:
+  struct qnode {
+    qnode() : locked_(false), pool_next_(nullptr) {}
+    std::atomic<bool> locked_;
+    qnode *pool_next_;
+    CACHE_PADOUT;
+  } CACHE_ALIGNED;
+  typedef private_::qnode_pool<qnode> pool;
+
+  std::atomic<qnode *> tail_;
+  // only accessed by the holder
+  qnode *holder_;
+  qnode *holder_pred_;
+};
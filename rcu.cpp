@@ -1,23 +1,42 @@
 #include <cassert>
 #include <ctime>
+#include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <new>
 #include <unistd.h>
 
 #include "rcu.hpp"
 #include "macros.hpp"
 #include "timer.hpp"
+#include "topology.hpp"
 
 using namespace std;
 
 atomic<rcu::epoch_t> rcu::global_epoch(0);
 atomic<bool> rcu::gc_thread_started(false);
+atomic<uint64_t> rcu::nreclaimed(0);
 
 __thread unsigned int rcu::tl_crit_section_depth = 0;
 __thread rcu::epoch_t rcu::tl_current_epoch = 0;
 
 spinlock rcu::rcu_mutex;
-aligned_padded_elem<rcu::sync> rcu::syncs[NSyncs];
+pthread_t rcu::gc_thread;
+int rcu::gc_cpu = -1;
+aligned_padded_elem<rcu::sync> *const rcu::syncs = rcu::make_syncs();
+
+aligned_padded_elem<rcu::sync> *
+rcu::make_syncs()
+{
+  void *p = nullptr;
+  if (posix_memalign(&p, CACHELINE_SIZE,
+                     sizeof(aligned_padded_elem<sync>) * NSyncs))
+    throw bad_alloc();
+  aligned_padded_elem<sync> *ret = static_cast<aligned_padded_elem<sync> *>(p);
+  for (size_t i = 0; i < NSyncs; i++)
+    new (&ret[i]) aligned_padded_elem<sync>();
+  return ret;
+}
 
 void
 rcu::init()
@@ -30,8 +49,22 @@ rcu::init()
     return;
   // start gc thread as daemon thread
   thread t(gc_loop);
+  gc_thread = t.native_handle(); // stays valid, since the thread never exits
+  if (gc_cpu >= 0)
+    topology::pin(gc_thread, gc_cpu);
   t.detach(); // daemonize
-  gc_thread_started.store(memory_order_release);
+  gc_thread_started.store(true, memory_order_release);
+}
+
+bool
+rcu::pin_gc_thread(unsigned int cpu)
+{
+  lock_guard<spinlock> l(rcu_mutex);
+  if (gc_thread_started.load(memory_order_acquire) &&
+      !topology::pin(gc_thread, cpu))
+    return false;
+  gc_cpu = cpu;
+  return true;
 }
 
 void
@@ -54,16 +87,36 @@ rcu::region_end()
   }
 }
 
-void
-rcu::free_with_fn(void *p, deleter_t fn)
+rcu::delete_queue &
+rcu::local_queue(size_t nretiring)
 {
   init(); // make sure RCU GC loop is running
   assert(tl_crit_section_depth);
   sync &s = sync_for_thread();
-  s.local_queues[tl_current_epoch % 2].push_back(move(delete_entry(p, fn)));
+  // we hold local_critical_mutex, so there are no concurrent writers
+  s.nretired.store(s.nretired.load(memory_order_relaxed) + nretiring,
+                   memory_order_relaxed);
+  return s.local_queues[tl_current_epoch % 2];
+}
+
+void
+rcu::free_with_fn(void *p, deleter_t fn)
+{
+  local_queue(1).push_back(delete_entry(p, fn));
+}
+
+uint64_t
+rcu::pending()
+{
+  // read nreclaimed first, so that the result never underflows
+  const uint64_t reclaimed = nreclaimed.load(memory_order_acquire);
+  uint64_t retired = 0;
+  for (size_t i = 0; i < NSyncs; i++)
+    retired += syncs[i].elem.nretired.load(memory_order_relaxed);
+  return retired > reclaimed ? retired - reclaimed : 0;
 }
 
-static const uint64_t rcu_epoch_us = 50 * 1000; /* 50 ms */
+static const uint64_t rcu_epoch_ns = 50 * 1000 * 1000; /* 50 ms */
 
 void
 rcu::gc_loop()
@@ -71,12 +124,17 @@ rcu::gc_loop()
   struct timespec t;
   memset(&t, 0, sizeof(t));
   timer loop_timer;
+  // what was freed during the previous epoch. a thread which entered a
+  // region after we last waited for it (and so got the new epoch), but
+  // before these objects were unlinked, can still be looking at them. they
+  // are only reclaimed once we have waited for every thread once more
+  delete_queue reclaimable;
   // runs as daemon thread
   for (;;) {
-    const uint64_t last_loop_usec = loop_timer.lap();
-    const uint64_t delay_time_usec = rcu_epoch_us;
-    if (last_loop_usec < delay_time_usec) {
-      t.tv_nsec = (delay_time_usec - last_loop_usec) * 1000;
+    const uint64_t last_loop_nsec = loop_timer.lap_nsec();
+    const uint64_t delay_time_nsec = rcu_epoch_ns;
+    if (last_loop_nsec < delay_time_nsec) {
+      t.tv_nsec = delay_time_nsec - last_loop_nsec;
       nanosleep(&t, NULL);
     }
 
@@ -92,7 +150,7 @@ rcu::gc_loop()
       sync &s = syncs[i].elem;
 
       {
-        lock_guard<spinlock> l(s.local_critical_mutex);
+        lock_guard<decltype(s.local_critical_mutex)> l(s.local_critical_mutex);
       }
 
       // now the next time the thread enters a critical section, it
@@ -103,9 +161,11 @@ rcu::gc_loop()
       q.clear();
     }
 
-    for (delete_queue::iterator it = elems.begin();
-         it != elems.end(); ++it)
+    for (delete_queue::iterator it = reclaimable.begin();
+         it != reclaimable.end(); ++it)
       it->second(it->first);
+    nreclaimed.fetch_add(reclaimable.size(), memory_order_release);
+    reclaimable.swap(elems);
     elems.clear();
   }
 }
@@ -6,9 +6,16 @@
 #include <functional>
 #include <vector>
 
+#include <pthread.h>
+
+#include "lock_profile.hpp"
 #include "spinlock.hpp"
 #include "util.hpp"
 
+namespace private_ {
+  LOCK_SITE(rcu_sync_site, "rcu::sync::local_critical_mutex");
+}
+
 class rcu {
 public:
   typedef uint64_t epoch_t;
@@ -38,14 +45,25 @@ public:
     sync(const sync &) = delete;
     sync &operator=(const sync &) = delete;
     delete_queue local_queues[2];
-    spinlock local_critical_mutex;
+    site_lock<spinlock, private_::rcu_sync_site> local_critical_mutex;
+    // objects ever pushed onto local_queues. only written w/
+    // local_critical_mutex held, but read w/o it by pending()
+    std::atomic<uint64_t> nretired;
   };
 
   static void region_begin();
   static void region_end();
 
+  // restricts the GC thread to cpu (which takes effect right away, if it is
+  // already running). returns false if the thread couldn't be pinned
+  static bool pin_gc_thread(unsigned int cpu);
+
   static void free_with_fn(void *p, deleter_t fn);
 
+  // number of objects which were freed, but not reclaimed yet. approximate
+  // while threads are freeing objects
+  static uint64_t pending();
+
   template <typename T>
   static inline void
   free(T *p)
@@ -60,9 +78,23 @@ public:
     free_with_fn(p, deleter_array<T>);
   }
 
+  // frees ps[0..n), paying for the thread's delete queue lookup once
+  template <typename T>
+  static inline void
+  free_batch(T *const *ps, size_t n)
+  {
+    delete_queue &q = local_queue(n);
+    for (size_t i = 0; i < n; i++)
+      q.push_back(delete_entry(ps[i], deleter<T>));
+  }
+
 private:
   static void init();
 
+  // the delete queue for the calling thread's current epoch, which nretiring
+  // objects are about to be pushed onto. must be called from within a region
+  static delete_queue &local_queue(size_t nretiring);
+
   static void gc_loop();
 
   static inline sync&
@@ -79,12 +111,21 @@ private:
 
   static std::atomic<bool> gc_thread_started; // init() is idempotent
 
+  static std::atomic<uint64_t> nreclaimed; // only written by the GC thread
+
+  // both protected by rcu_mutex
+  static pthread_t gc_thread;
+  static int gc_cpu; // -1 if not pinned
+
   // allows recursive RCU regions
   static __thread unsigned int tl_crit_section_depth;
   static __thread epoch_t tl_current_epoch;
 
+  // never destroyed, since the GC thread keeps running (and looking at them)
+  // while static objects are destroyed at exit
   static const size_t NSyncs = 1024;
-  static aligned_padded_elem<sync> syncs[NSyncs];
+  static aligned_padded_elem<sync> *const syncs;
+  static aligned_padded_elem<sync> *make_syncs();
 };
 
 class scoped_rcu_region {
@@ -112,4 +153,11 @@ public:
   {
     rcu::free_with_fn(p, rcu::deleter<T>);
   }
+
+  template <typename T>
+  inline void
+  release_batch(T *const *ps, size_t n) const
+  {
+    rcu::free_batch(ps, n);
+  }
 };
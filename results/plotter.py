@@ -1,37 +1,111 @@
 #!/usr/bin/env python
 
+from __future__ import division, print_function
+
+import json
 import matplotlib
 import pylab as plt
 import sys
 import math
 
 BENCHMARKS=('readonly', 'queue')
-POLICIES = ('global_lock', 'per_node_lock', 'lock_free', 'lock_free_rcu')
+POLICIES = ('global_lock', 'global_rwlock', 'global_seqlock', 'per_node_lock', 'lock_free', 'lock_free_rcu', 'lazy', 'two_lock_queue', 'null')
+# shortened names, so the legend fits
+POLICY_NAMES = ('g-lock', 'g-rwlock', 'g-seqlock', 'pn-lock', 'lock-f', 'lock-f-rcu', 'lazy', '2l-queue', 'null',)
+LOCKS = ('tas', 'ttas', 'ttas-exp', 'ttas-prop', 'mutex', 'mcs', 'clh', 'hybrid', 'cohort')
+# config keys which make for plots of their own
+SWEEP_KEYS = ('ratio', 'lock', 'dist', 'size', 'value_size')
+
+def config_key(config):
+  return tuple(sorted(config.items()))
+
+def load(rfile):
+  """returns the (config, throughput) pairs in rfile, and the half-widths of
+  their confidence intervals by config_key(), if known. rfile is the output
+  of runner.py, or one of an older runner.py (RESULTS = [...])"""
+  with open(rfile) as f:
+    text = f.read()
+  if text.lstrip().startswith('{'):
+    results = json.loads(text)['results']
+    return ([(r['config'], r['mean']) for r in results],
+            dict((config_key(r['config']), r['ci95']) for r in results))
+  scope = {}
+  exec(text, scope)
+  return (scope['RESULTS'], {})
+
+def plot(title, results, outfile, key='policy', series=POLICIES, names=POLICY_NAMES,
+         xkey='threads', xlabel='num cores', cis={}):
+  fig = plt.figure()
+  ax = plt.subplot(111)
+  #logscale = title == 'readonly'
+  logscale = False
+  trfm = (lambda x: math.log(x, 10)) if logscale else (lambda x: x)
+  for name in series:
+    configs = [(x, y) for (x, y) in results if x.get(key) == name]
+    configs = sorted([(x[xkey], y / x['threads'], cis.get(config_key(x), 0.0) / x['threads'])
+                      for (x, y) in configs], key=lambda x: x[0])
+    if cis and not logscale:
+      ax.errorbar([x[0] for x in configs], [x[1] for x in configs],
+                  yerr=[x[2] for x in configs])
+    else:
+      ax.plot([x[0] for x in configs], [trfm(x[1]) for x in configs])
+
+  if xkey == 'size':
+    ax.set_xscale('log')
+  ax.set_xlabel(xlabel)
+  ax.set_ylabel('throughput (ops/sec/core)')
+  ax.set_title(title)
+
+  # hacky: see http://stackoverflow.com/questions/4700614/how-to-put-the-legend-out-of-the-plot
+  box = ax.get_position()
+  ax.set_position([box.x0, box.y0 + box.height * 0.1, box.width, box.height * 0.9])
+  ax.legend(names,
+      loc='upper center', bbox_to_anchor=(0.5, -0.10),
+      fancybox=True, shadow=True, ncol=len(series))
+
+  fig.savefig(outfile)
 
 if __name__ == '__main__':
   (_, rfile, outprefix) = sys.argv
-  execfile(rfile)
+  (RESULTS, CIS) = load(rfile)
   for bench in BENCHMARKS:
-    fig = plt.figure()
-    ax = plt.subplot(111)
-    #logscale = bench == 'readonly'
-    logscale = False
-    trfm = (lambda x: math.log(x, 10)) if logscale else (lambda x: x)
-    for policy in POLICIES:
-      configs = [(x, y) for (x, y) in RESULTS if x['bench'] == bench and x['policy'] == policy]
-      configs = sorted([(x['threads'], y) for (x, y) in configs], key=lambda x: x[0])
-      ax.plot([x[0] for x in configs], [trfm(x[1]/float(x[0])) for x in configs])
-
-    ax.set_xlabel('num cores')
-    ax.set_ylabel('throughput (ops/sec/core)')
-    ax.set_title(bench)
-
-    # hacky: see http://stackoverflow.com/questions/4700614/how-to-put-the-legend-out-of-the-plot
-    box = ax.get_position()
-    ax.set_position([box.x0, box.y0 + box.height * 0.1, box.width, box.height * 0.9])
-    # shorten the names so they fit
-    ax.legend(('g-lock', 'pn-lock', 'lock-f', 'lock-f-rcu',),
-        loc='upper center', bbox_to_anchor=(0.5, -0.10),
-        fancybox=True, shadow=True, ncol=len(POLICIES))
-
-    fig.savefig(outprefix + '-' + bench + '.pdf')
+    # configs w/ an explicit producer:consumer ratio, lock type, key
+    # distribution or list footprint get plots of their own
+    results = [(x, y) for (x, y) in RESULTS
+               if x['bench'] == bench and not any(k in x for k in SWEEP_KEYS)]
+    plot(bench, results, outprefix + '-' + bench + '.pdf', cis=CIS)
+  ratios = sorted(set(x['ratio'] for (x, _) in RESULTS if 'ratio' in x))
+  for ratio in ratios:
+    results = [(x, y) for (x, y) in RESULTS if x.get('ratio') == ratio]
+    plot('queue (producers:consumers = %s)' % ratio, results,
+         outprefix + '-queue-' + ratio.replace(':', 'to') + '.pdf', cis=CIS)
+  results = [(x, y) for (x, y) in RESULTS
+             if x['bench'] == 'lock' and 'oversubscribed' not in x]
+  if results:
+    plot('lock', results, outprefix + '-lock.pdf', 'lock', LOCKS, LOCKS, cis=CIS)
+  results = [(x, y) for (x, y) in RESULTS
+             if x['bench'] == 'lock' and 'oversubscribed' in x]
+  if results:
+    plot('lock (oversubscribed)', results,
+         outprefix + '-lock-oversubscribed.pdf', 'lock', LOCKS, LOCKS, cis=CIS)
+  for policy in ('global_lock', 'per_node_lock'):
+    results = [(x, y) for (x, y) in RESULTS
+               if x['bench'] == 'queue' and x.get('policy') == policy and 'lock' in x]
+    if results:
+      plot('queue (%s, by lock type)' % policy, results,
+           outprefix + '-queue-' + policy + '-locks.pdf', 'lock', LOCKS, LOCKS,
+           cis=CIS)
+  dists = sorted(set(x['dist'] for (x, _) in RESULTS if 'dist' in x))
+  for dist in dists:
+    results = [(x, y) for (x, y) in RESULTS if x.get('dist') == dist]
+    plot('mixed (%s keys)' % dist, results,
+         outprefix + '-mixed-' + dist + '.pdf', cis=CIS)
+  # the list footprint sweeps, one plot per value size and thread count
+  sweeps = sorted(set((x['value_size'], x['threads'])
+                      for (x, _) in RESULTS if 'value_size' in x))
+  for (value_size, nthreads) in sweeps:
+    results = [(x, y) for (x, y) in RESULTS
+               if x.get('value_size') == value_size and x['threads'] == nthreads]
+    plot('%s (%d-byte values, %d threads)' % (results[0][0]['bench'], value_size, nthreads),
+         results, outprefix + '-%s-%dB-%dt.pdf' % (results[0][0]['bench'], value_size, nthreads),
+         xkey='size', xlabel='initial size (elems)', cis=CIS)
@@ -1,14 +1,51 @@
 #!/usr/bin/env python
+#
+# Runs every configuration of GRIDS a number of times, and writes the mean
+# throughput (and its 95% confidence interval) of each, along w/ the full
+# output of every trial (see bench --format json), to a JSON file. Given the
+# output of an earlier run as a --baseline, exits w/ 1 if any configuration
+# got significantly slower.
+#
+# The null policy doesn't have a list at all, so its throughput is the one of
+# the benchmark harness alone. Every configuration w/ a policy gets its net
+# throughput too, w/ the harness's time per op (from the same configuration
+# under the null policy) subtracted.
 
+from __future__ import division, print_function
+
+import argparse
 import itertools
+import json
+import math
+import multiprocessing
 import platform
 import subprocess
 import sys
 
 # config for tom
 RUNTIME=30
+NCPUS = multiprocessing.cpu_count()
+# thread placement (see bench --pin), so that runs are reproducible
+PIN = 'compact'
 THREADS = (1, 6, 12, 18, 24, 30, 36, 42, 48)
-POLICIES = ('global_lock', 'per_node_lock', 'lock_free', 'lock_free_rcu')
+POLICIES = ('global_lock', 'global_rwlock', 'global_seqlock', 'per_node_lock', 'lock_free', 'lock_free_rcu', 'lazy', 'two_lock_queue', 'null')
+LOCKS = ('tas', 'ttas', 'ttas-exp', 'ttas-prop', 'mutex', 'mcs', 'clh', 'hybrid', 'cohort')
+# threads per cpu, for the oversubscribed runs
+OVERSUBSCRIBE = (2, 4, 8)
+# key distributions of the mixed workload (see bench --key-dist)
+KEY_DISTS = ('uniform', 'zipfian', 'hotspot')
+# list footprints, from cache-resident to DRAM-bound (see bench --initial-size
+# and --value-size)
+INITIAL_SIZES = (100, 10000, 100000)
+VALUE_SIZES = (64, 256, 1024)
+
+# measured runs per configuration, and runs thrown away before them (which
+# warm up the page cache, cpu frequency etc)
+TRIALS = 3
+WARMUP_TRIALS = 1
+# how much slower than the baseline (in %) a configuration has to get to be a
+# regression, on top of the confidence intervals not overlapping
+THRESHOLD = 5.0
 
 GRIDS = [
   {'benchmarks' : ('readonly',),
@@ -17,29 +54,213 @@ GRIDS = [
   {'benchmarks' : ('queue',),
    'policies' : POLICIES,
    'threads' : tuple(t for t in THREADS if t > 1)},
+  # producer:consumer ratios, for the policies which care about them
+  {'benchmarks' : ('queue',),
+   'policies' : ('per_node_lock', 'lock_free', 'two_lock_queue', 'null'),
+   'threads' : tuple(t for t in THREADS if t > 1),
+   'ratios' : ((1, 3), (3, 1))},
+  # the lock plugged into global_lock (its global lock) and per_node_lock (its
+  # tail lock)
+  {'benchmarks' : ('queue',),
+   'policies' : ('global_lock', 'per_node_lock'),
+   'locks' : LOCKS,
+   'threads' : tuple(t for t in THREADS if t > 1)},
+  # the lock benchmark doesn't involve a policy
+  {'benchmarks' : ('lock',),
+   'locks' : LOCKS,
+   'threads' : THREADS},
+  # more threads than cpus, so lock holders get descheduled
+  {'benchmarks' : ('lock',),
+   'locks' : LOCKS,
+   'threads' : tuple(f * NCPUS for f in OVERSUBSCRIBE),
+   'oversubscribed' : True},
+  # the default op mix, w/ uniform and skewed keys
+  {'benchmarks' : ('mixed',),
+   'policies' : POLICIES,
+   'threads' : THREADS,
+   'dists' : KEY_DISTS},
+  # traversals over growing lists of growing values
+  {'benchmarks' : ('readonly',),
+   'policies' : POLICIES,
+   'threads' : (1, NCPUS),
+   'sizes' : INITIAL_SIZES,
+   'value_sizes' : VALUE_SIZES},
 ]
 
-def run_configuration(bench, policy, nthreads):
+# two-sided 95% quantiles of Student's t distribution, by degrees of freedom
+T_95 = (12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042)
+
+def summarize(xs):
+  """the mean, standard deviation and half-width of the 95% CI of xs"""
+  n = len(xs)
+  mean = sum(xs) / n
+  if n < 2:
+    return (mean, 0.0, 0.0)
+  stddev = math.sqrt(sum((x - mean) ** 2 for x in xs) / (n - 1))
+  t = T_95[n - 2] if n - 1 <= len(T_95) else 1.960
+  return (mean, stddev, t * stddev / math.sqrt(n))
+
+def configurations():
+  for grid in GRIDS:
+    for (bench, policy, lock, nthreads, ratio, dist, size, value_size) in \
+        itertools.product(grid['benchmarks'], grid.get('policies', (None,)),
+                          grid.get('locks', (None,)), grid['threads'],
+                          grid.get('ratios', (None,)),
+                          grid.get('dists', (None,)),
+                          grid.get('sizes', (None,)),
+                          grid.get('value_sizes', (None,))):
+      config = { 'bench' : bench, 'threads' : nthreads, 'pin' : PIN, }
+      if policy is not None:
+        config['policy'] = policy
+      if lock is not None:
+        config['lock'] = lock
+      if dist is not None:
+        config['dist'] = dist
+      if size is not None:
+        config['size'] = size
+      if value_size is not None:
+        config['value_size'] = value_size
+      if grid.get('oversubscribed'):
+        config['oversubscribed'] = True
+      if ratio is not None:
+        (p, c) = ratio
+        config['producers'] = max(1, min(nthreads - 1, nthreads * p // (p + c)))
+        config['ratio'] = '%d:%d' % ratio
+      yield config
+
+def run_configuration(config, runtime):
+  """runs bench once, and returns its output (see bench --format json)"""
   args = [
     './bench',
-    '--bench', bench,
-    '--policy', policy,
-    '--num-threads', str(nthreads),
-    '--runtime', str(RUNTIME)]
-  p = subprocess.Popen(args, stdin=open('/dev/null', 'r'), stdout=subprocess.PIPE)
-  r = p.stdout.read()
-  p.wait()
-  return float(r.strip())
+    '--format', 'json',
+    '--bench', config['bench'],
+    '--num-threads', str(config['threads']),
+    '--runtime', str(runtime),
+    '--pin', config['pin']]
+  if 'policy' in config:
+    args.extend(['--policy', config['policy']])
+  if 'lock' in config:
+    args.extend(['--lock-type', config['lock']])
+  if 'producers' in config:
+    args.extend(['--num-producers', str(config['producers'])])
+  if 'dist' in config:
+    args.extend(['--key-dist', config['dist']])
+  if 'size' in config:
+    args.extend(['--initial-size', str(config['size'])])
+  if 'value_size' in config:
+    args.extend(['--value-type', 'payload',
+                 '--value-size', str(config['value_size'])])
+  out = subprocess.check_output(args, stdin=open('/dev/null', 'r'))
+  return json.loads(out.decode('utf-8'))
+
+def config_key(config):
+  return tuple(sorted(config.items()))
+
+def matches(config, filters):
+  return all(str(config.get(k)) == v for (k, v) in filters)
+
+def net_throughput(mean, null_mean):
+  """the throughput w/o the harness's time per op, ie 1/(1/mean - 1/null_mean)
+  (per thread, both sides scale w/ the number of threads). None if mean is
+  within noise of the harness's own throughput"""
+  if not mean or not null_mean or mean >= null_mean:
+    return None
+  return 1.0 / (1.0 / mean - 1.0 / null_mean)
+
+def add_net_throughputs(results):
+  """adds the harness's ns per op (per thread) and the net throughput to every
+  result w/ a matching null policy result"""
+  nulls = dict((config_key(r['config']), r) for r in results
+               if r['config'].get('policy') == 'null')
+  for r in results:
+    if r['config'].get('policy') in (None, 'null'):
+      continue
+    # the lock type doesn't apply to the null policy
+    config = dict((k, v) for (k, v) in r['config'].items() if k != 'lock')
+    config['policy'] = 'null'
+    n = nulls.get(config_key(config))
+    if n is None or not n['mean']:
+      continue
+    r['harness_ns_per_op'] = 1e9 * config['threads'] / n['mean']
+    r['net_mean'] = net_throughput(r['mean'], n['mean'])
+
+def find_regressions(results, baseline, threshold):
+  """the configurations of results which got slower than in baseline, by more
+  than threshold % and w/o the confidence intervals overlapping"""
+  base = dict((config_key(r['config']), r) for r in baseline['results'])
+  regressions = []
+  for r in results:
+    b = base.get(config_key(r['config']))
+    if b is None:
+      continue
+    change = 100.0 * (r['mean'] - b['mean']) / b['mean'] if b['mean'] else 0.0
+    if change < -threshold and r['mean'] + r['ci95'] < b['mean'] - b['ci95']:
+      regressions.append((r, b, change))
+  return regressions
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument('outfile')
+  parser.add_argument('--runtime', type=int, default=RUNTIME,
+                      help='seconds per trial (default: %(default)s)')
+  parser.add_argument('--trials', type=int, default=TRIALS,
+                      help='measured trials per configuration (default: %(default)s)')
+  parser.add_argument('--warmup-trials', type=int, default=WARMUP_TRIALS,
+                      help='trials thrown away before those (default: %(default)s)')
+  parser.add_argument('--only', action='append', default=[],
+                      metavar='KEY=VALUE',
+                      help='only run the configurations w/ KEY=VALUE, eg policy=lock_free')
+  parser.add_argument('--baseline',
+                      help='the output of an earlier run, to check for regressions against')
+  parser.add_argument('--threshold', type=float, default=THRESHOLD,
+                      help='slowdown (in %%) which counts as a regression (default: %(default)s)')
+  args = parser.parse_args()
+  if args.trials < 1 or args.warmup_trials < 0:
+    parser.error('need --trials > 0 and --warmup-trials >= 0')
+  filters = []
+  for f in args.only:
+    if '=' not in f:
+      parser.error('--only needs KEY=VALUE')
+    filters.append(tuple(f.split('=', 1)))
 
-if __name__ == '__main__':
-  (_, outfile) = sys.argv
   results = []
-  for grid in GRIDS:
-    for (bench, policy, nthreads) in \
-        itertools.product(grid['benchmarks'], grid['policies'], grid['threads']):
-      config = { 'bench' : bench, 'policy' : policy, 'threads' : nthreads, }
-      print >>sys.stderr, '[INFO] running config', config
-      throughput = run_configuration(bench, policy, nthreads)
-      results.append((config, throughput))
-  with open(outfile, 'w') as f:
-    print >>f, 'RESULTS = %s' % repr(results)
+  for config in configurations():
+    if not matches(config, filters):
+      continue
+    print('[INFO] running config', config, file=sys.stderr)
+    for _ in range(args.warmup_trials):
+      run_configuration(config, args.runtime)
+    trials = [run_configuration(config, args.runtime)
+              for _ in range(args.trials)]
+    throughputs = [t['results']['ops_per_sec'] for t in trials]
+    (mean, stddev, ci95) = summarize(throughputs)
+    print('[INFO]   %.0f ops/sec +/- %.0f (%.1f%%)' %
+          (mean, ci95, 100.0 * ci95 / mean if mean else 0.0), file=sys.stderr)
+    results.append({'config' : config, 'mean' : mean, 'stddev' : stddev,
+                    'ci95' : ci95, 'ops_per_sec' : throughputs,
+                    'trials' : trials})
+  add_net_throughputs(results)
+
+  output = {'host' : platform.node(), 'runtime' : args.runtime,
+            'trials' : args.trials, 'warmup_trials' : args.warmup_trials,
+            'results' : results}
+  with open(args.outfile, 'w') as f:
+    json.dump(output, f, indent=1, sort_keys=True)
+
+  if args.baseline:
+    with open(args.baseline) as f:
+      baseline = json.load(f)
+    regressions = find_regressions(results, baseline, args.threshold)
+    for (r, b, change) in regressions:
+      print('[REGRESSION] %s: %.0f +/- %.0f ops/sec, was %.0f +/- %.0f (%+.1f%%)' %
+            (r['config'], r['mean'], r['ci95'], b['mean'], b['ci95'], change),
+            file=sys.stderr)
+    if regressions:
+      return 1
+    print('[INFO] no regressions against', args.baseline, file=sys.stderr)
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "asm.hpp"
+#include "lock_profile.hpp"
+#include "macros.hpp"
+
+// tags describing how a data structure protected by a lock may be read:
+// exclusive_read_tag: readers take the lock like writers do
+// shared_read_tag: readers call lock_shared()/unlock_shared()
+// optimistic_read_tag: readers take no lock, and instead validate what they
+//   read w/ read_begin()/read_retry()
+struct exclusive_read_tag {};
+struct shared_read_tag {};
+struct optimistic_read_tag {};
+
+template <typename LockImpl>
+struct lock_read_traits {
+  typedef exclusive_read_tag read_tag;
+};
+
+// Reader-writer spinlock, which implements the Lockable concept (C++11) for
+// writers, plus lock_shared()/unlock_shared() for readers.
+//
+// Writers announce themselves by setting WriterWaiting, which keeps new
+// readers from entering, so that a steady stream of readers cannot starve
+// writers.
+class rwlock {
+public:
+  rwlock() : state_(0) {}
+
+  // non-copyable/non-movable
+  rwlock(const rwlock &) = delete;
+  rwlock(rwlock &&) = delete;
+  rwlock &operator=(const rwlock &) = delete;
+
+  inline void
+  lock()
+  {
+    for (;;) {
+      uint32_t s = state_.load(std::memory_order_relaxed);
+      // no readers and no writer. clears WriterWaiting, which other waiting
+      // writers will set again
+      if (!(s & ~WriterWaiting) &&
+          state_.compare_exchange_weak(s, Writer, std::memory_order_acquire))
+        return;
+      if (!(s & WriterWaiting))
+        state_.fetch_or(WriterWaiting, std::memory_order_relaxed);
+      lock_profile::spin();
+    }
+  }
+
+  inline void
+  unlock()
+  {
+    state_.fetch_and(~Writer, std::memory_order_release);
+  }
+
+  inline bool
+  try_lock()
+  {
+    uint32_t s = state_.load(std::memory_order_relaxed);
+    return !(s & ~WriterWaiting) &&
+      state_.compare_exchange_strong(s, Writer, std::memory_order_acquire);
+  }
+
+  inline void
+  lock_shared()
+  {
+    for (;;) {
+      uint32_t s = state_.load(std::memory_order_relaxed);
+      if (!(s & (Writer | WriterWaiting)) &&
+          state_.compare_exchange_weak(s, s + 1, std::memory_order_acquire))
+        return;
+      lock_profile::spin();
+    }
+  }
+
+  inline void
+  unlock_shared()
+  {
+    state_.fetch_sub(1, std::memory_order_release);
+  }
+
+private:
+  // the low bits count readers
+  static const uint32_t Writer = 1U << 31;
+  static const uint32_t WriterWaiting = 1U << 30;
+
+  std::atomic<uint32_t> state_;
+};
+
+template <>
+struct lock_read_traits<rwlock> {
+  typedef shared_read_tag read_tag;
+};
+
+// Sequence lock: writers are mutually exclusive (Lockable concept), and make
+// the version odd for the duration of their critical section. Readers never
+// write to the lock; instead, they read the version before and after reading
+// the protected data, and retry if it changed:
+//
+//   uint64_t v;
+//   do {
+//     v = l.read_begin();
+//     ... read protected data ...
+//   } while (l.read_retry(v));
+//
+// Readers can observe data in the middle of being modified, so the protected
+// data must be read w/ atomic loads, and must not be freed by writers while
+// readers might still dereference it.
+class seqlock {
+public:
+  seqlock() : version_(0) {}
+
+  // non-copyable/non-movable
+  seqlock(const seqlock &) = delete;
+  seqlock(seqlock &&) = delete;
+  seqlock &operator=(const seqlock &) = delete;
+
+  inline void
+  lock()
+  {
+    while (!try_lock())
+      lock_profile::spin();
+  }
+
+  inline void
+  unlock()
+  {
+    version_.fetch_add(1, std::memory_order_release);
+  }
+
+  inline bool
+  try_lock()
+  {
+    uint64_t v = version_.load(std::memory_order_relaxed);
+    if ((v & 0x1) ||
+        !version_.compare_exchange_strong(v, v + 1, std::memory_order_acquire))
+      return false;
+    // keeps the writes of the critical section from becoming visible before
+    // the version is odd
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+  }
+
+  // waits out any writer, and returns the (even) version
+  inline uint64_t
+  read_begin() const
+  {
+    for (;;) {
+      uint64_t v = version_.load(std::memory_order_acquire);
+      if (likely(!(v & 0x1)))
+        return v;
+      nop_pause();
+    }
+  }
+
+  // true if a writer might have run since read_begin() returned v
+  inline bool
+  read_retry(uint64_t v) const
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) != v;
+  }
+
+private:
+  std::atomic<uint64_t> version_;
+};
+
+template <>
+struct lock_read_traits<seqlock> {
+  typedef optimistic_read_tag read_tag;
+};
+
+// RAII guard for lock_shared()/unlock_shared()
+template <typename LockImpl>
+class shared_lock_guard {
+public:
+  explicit shared_lock_guard(LockImpl &l) : l_(l) { l_.lock_shared(); }
+  ~shared_lock_guard() { l_.unlock_shared(); }
+
+  shared_lock_guard(const shared_lock_guard &) = delete;
+  shared_lock_guard &operator=(const shared_lock_guard &) = delete;
+
+private:
+  LockImpl &l_;
+};
@@ -2,22 +2,28 @@
 
 #include <atomic>
 #include "asm.hpp"
+#include "backoff.hpp"
+#include "lock_profile.hpp"
 
+// Test-and-set spinlock: every waiter keeps issuing exchanges, each of which
+// takes the cache line away from the holder (and from the other waiters).
+// Kept around as a baseline for the lock benchmark.
+//
 // implements Lockable concept (C++11)
-class spinlock {
+class tas_spinlock {
 public:
-  spinlock() : flag_(false) {}
+  tas_spinlock() : flag_(false) {}
 
   // non-copyable/non-movable
-  spinlock(const spinlock &) = delete;
-  spinlock(spinlock &&) = delete;
-  spinlock &operator=(const spinlock &) = delete;
+  tas_spinlock(const tas_spinlock &) = delete;
+  tas_spinlock(tas_spinlock &&) = delete;
+  tas_spinlock &operator=(const tas_spinlock &) = delete;
 
   inline void
   lock()
   {
     while (flag_.exchange(true, std::memory_order_acquire))
-      nop_pause();
+      lock_profile::spin();
   }
 
   inline void
@@ -35,3 +41,52 @@ public:
 private:
   std::atomic<bool> flag_;
 };
+
+// Test-and-test-and-set spinlock: waiters spin on a relaxed load, which hits
+// in their own cache until the holder releases the lock, and only then try
+// the exchange. BackoffImpl (see backoff.hpp) decides how long to wait after
+// losing such a race, before spinning on the flag again.
+//
+// implements Lockable concept (C++11)
+template <typename BackoffImpl = no_backoff>
+class ttas_spinlock {
+public:
+  ttas_spinlock() : flag_(false) {}
+
+  // non-copyable/non-movable
+  ttas_spinlock(const ttas_spinlock &) = delete;
+  ttas_spinlock(ttas_spinlock &&) = delete;
+  ttas_spinlock &operator=(const ttas_spinlock &) = delete;
+
+  inline void
+  lock()
+  {
+    if (likely(try_lock()))
+      return;
+    BackoffImpl backoff;
+    for (;;) {
+      while (flag_.load(std::memory_order_relaxed))
+        lock_profile::spin();
+      if (try_lock())
+        return;
+      backoff.fail();
+    }
+  }
+
+  inline void
+  unlock()
+  {
+    flag_.store(false, std::memory_order_release);
+  }
+
+  inline bool
+  try_lock()
+  {
+    return !flag_.exchange(true, std::memory_order_acquire);
+  }
+
+private:
+  std::atomic<bool> flag_;
+};
+
+typedef ttas_spinlock<> spinlock;
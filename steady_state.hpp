@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/**
+ * Finds where the warm-up period of a series of measurements (eg the
+ * throughput of consecutive sampling intervals) ends, w/ the MSER-5 rule:
+ * the series is averaged over batches of 5, and truncated at the batch which
+ * minimizes the standard error of the mean of the remaining batches. Only the
+ * first half of the series is considered for truncation, so that a slump
+ * towards the end can't pass for the steady state.
+ *
+ * Returns the index of the first steady measurement, which is 0 for series
+ * too short to tell.
+ */
+static inline size_t
+mser5_warmup(const std::vector<double> &xs)
+{
+  static const size_t BatchSize = 5;
+  const size_t nbatches = xs.size() / BatchSize;
+  if (nbatches < 2)
+    return 0;
+  std::vector<double> batches(nbatches, 0.0);
+  for (size_t i = 0; i < nbatches * BatchSize; i++)
+    batches[i / BatchSize] += xs[i] / BatchSize;
+
+  // suffix sums, so that every truncation point costs O(1)
+  std::vector<double> sum(nbatches + 1, 0.0), sum_sq(nbatches + 1, 0.0);
+  for (size_t i = nbatches; i-- > 0;) {
+    sum[i] = sum[i + 1] + batches[i];
+    sum_sq[i] = sum_sq[i + 1] + batches[i] * batches[i];
+  }
+
+  size_t best = 0;
+  double best_mser = std::numeric_limits<double>::max();
+  for (size_t d = 0; d <= nbatches / 2; d++) {
+    const double n = double(nbatches - d);
+    const double mean = sum[d] / n;
+    const double sq_dev = std::max(sum_sq[d] - n * mean * mean, 0.0);
+    const double mser = sq_dev / (n * n);
+    if (mser < best_mser) {
+      best_mser = mser;
+      best = d;
+    }
+  }
+  return best * BatchSize;
+}
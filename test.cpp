@@ -1,15 +1,28 @@
 #include <cassert>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <initializer_list>
 #include <vector>
 #include <algorithm>
+#include <mutex>
 #include <thread>
+#include <unistd.h>
 
 #include "policy.hpp"
 #include "asm.hpp"
 #include "rcu.hpp"
 #include "macros.hpp"
 #include "atomic_reference.hpp"
+#include "spinlock.hpp"
+#include "topology.hpp"
+#include "histogram.hpp"
+#include "json_writer.hpp"
+#include "memory_usage.hpp"
+#include "perf_counters.hpp"
+#include "steady_state.hpp"
+#include "timer.hpp"
+#include "workload.hpp"
 
 using namespace std;
 
@@ -60,6 +73,309 @@ atomic_ref_ptr_tests()
   deleted = false;
 }
 
+template <typename LockImpl>
+static void
+lock_increment(LockImpl &lock, atomic<bool> &f, uint64_t &counter, int n)
+{
+  while (!f.load())
+    nop_pause();
+  for (int i = 0; i < n; i++) {
+    lock_guard<LockImpl> l(lock);
+    counter++;
+  }
+}
+
+// FIFO locks (the queue locks, and cohort_lock's ticket locks) get a smaller
+// NIncrementsPerThread, so that they finish quickly even when oversubscribed,
+// where every handoff waits for the next thread in line to be scheduled
+template <typename LockImpl, int NIncrementsPerThread = 100000>
+static void
+lock_tests()
+{
+  LockImpl lock;
+  ASSERT(lock.try_lock());
+  ASSERT(!lock.try_lock());
+  lock.unlock();
+  ASSERT(lock.try_lock());
+  lock.unlock();
+
+  // a non-atomic counter only adds up if the lock excludes everybody else
+  const int NThreads = 4;
+  uint64_t counter = 0;
+  vector<thread> thds;
+  atomic<bool> start_flag(false);
+  for (int i = 0; i < NThreads; i++) {
+    thread t(lock_increment<LockImpl>, ref(lock), ref(start_flag), ref(counter), NIncrementsPerThread);
+    thds.push_back(move(t));
+  }
+  start_flag.store(true);
+  for (auto &t : thds)
+    t.join();
+  ASSERT(counter == uint64_t(NThreads * NIncrementsPerThread));
+}
+
+static void
+topology_tests()
+{
+  ASSERT(topology::parse_cpulist("0-3,8,10-11\n") ==
+         vector<unsigned int>({0, 1, 2, 3, 8, 10, 11}));
+  ASSERT(topology::parse_cpulist("5") == vector<unsigned int>({5}));
+  ASSERT(topology::parse_cpulist("").empty());
+
+  // every cpu belongs to the node which lists it
+  ASSERT(topology::num_nodes() >= 1);
+  ASSERT(topology::num_cpus() >= 1);
+  for (size_t node = 0; node < topology::num_nodes(); node++)
+    for (unsigned int cpu : topology::cpus_of_node(node))
+      ASSERT(topology::node_of_cpu(cpu) == node);
+  ASSERT(topology::current_node() < topology::num_nodes());
+
+  // placements visit every cpu once
+  vector<unsigned int> compact = topology::compact_order();
+  vector<unsigned int> scatter = topology::scatter_order();
+  ASSERT(!compact.empty());
+  sort(compact.begin(), compact.end());
+  sort(scatter.begin(), scatter.end());
+  ASSERT(compact == scatter);
+  ASSERT(unique(compact.begin(), compact.end()) == compact.end());
+}
+
+static void
+histogram_tests()
+{
+  latency_histogram h;
+  ASSERT(h.count() == 0);
+  ASSERT(h.percentile(0.5) == 0);
+
+  // small values are exact
+  for (uint64_t v = 1; v <= 10; v++)
+    h.record(v);
+  ASSERT(h.count() == 10);
+  ASSERT(h.max() == 10);
+  ASSERT(h.percentile(0.5) == 5);
+  ASSERT(h.percentile(1.0) == 10);
+
+  // large values are within the relative error of a bucket
+  latency_histogram h1;
+  for (uint64_t v = 1; v <= 100000; v++)
+    h1.record(v * 1000);
+  const uint64_t p99 = h1.percentile(0.99);
+  ASSERT(p99 >= 99000000 && p99 <= 99000000 + 99000000 / 16);
+  ASSERT(h1.percentile(1.0) == 100000000);
+
+  h.merge(h1);
+  ASSERT(h.count() == 100010);
+  ASSERT(h.max() == 100000000);
+
+  // every value is at most its bucket's upper bound, which is increasing
+  for (uint64_t v : {uint64_t(0), uint64_t(15), uint64_t(16), uint64_t(17),
+                     uint64_t(1) << 40, ~uint64_t(0)}) {
+    const size_t b = latency_histogram::bucket_of(v);
+    ASSERT(b < latency_histogram::NBuckets);
+    ASSERT(v <= latency_histogram::upper_bound_of(b));
+    ASSERT(!b || v > latency_histogram::upper_bound_of(b - 1));
+  }
+}
+
+static void
+timer_tests()
+{
+  ASSERT(tsc_clock::ticks_per_nsec() > 0.0);
+  const uint64_t t0 = tsc_clock::ticks();
+  const uint64_t t1 = tsc_clock::ticks();
+  ASSERT(t1 >= t0);
+
+  // the calibrated clock agrees w/ CLOCK_MONOTONIC (loosely, since we might
+  // get descheduled in between)
+  timer t;
+  const uint64_t ns0 = monotonic_nsec();
+  usleep(20000);
+  const uint64_t elapsed_nsec = t.lap_nsec();
+  const uint64_t monotonic_elapsed_nsec = monotonic_nsec() - ns0;
+  ASSERT(elapsed_nsec >= 19000000);
+  ASSERT(elapsed_nsec <= monotonic_elapsed_nsec + monotonic_elapsed_nsec / 10);
+}
+
+static void
+workload_tests()
+{
+  static const uint64_t NKeys = 100, NDraws = 100000;
+  fast_random r(1);
+  for (int i = 0; i < 1000; i++)
+    ASSERT(r.next_below(7) < 7);
+
+  // every distribution stays in range, and the skewed ones are skewed
+  vector<uint64_t> uniform(NKeys), zipfian(NKeys), hotspot(NKeys);
+  const key_distribution u = key_distribution::uniform(NKeys);
+  const key_distribution z = key_distribution::zipfian(NKeys, 0.99);
+  const key_distribution h = key_distribution::hotspot(NKeys, 0.2, 0.8);
+  for (uint64_t i = 0; i < NDraws; i++) {
+    const uint64_t ku = u.next(r), kz = z.next(r), kh = h.next(r);
+    ASSERT(ku < NKeys && kz < NKeys && kh < NKeys);
+    uniform[ku]++;
+    zipfian[kz]++;
+    hotspot[kh]++;
+  }
+  for (uint64_t n : uniform)
+    ASSERT(n > NDraws / NKeys / 2 && n < NDraws / NKeys * 2);
+  // key 0 is picked ~1 / H(100, 0.99) ~ 19% of the time, key 9 ~2%
+  ASSERT(zipfian[0] > NDraws / 7 && zipfian[0] < NDraws / 4);
+  ASSERT(zipfian[0] > zipfian[9] * 5);
+  uint64_t nhot = 0;
+  for (uint64_t k = 0; k < NKeys / 5; k++)
+    nhot += hotspot[k];
+  ASSERT(nhot > NDraws * 3 / 4 && nhot < NDraws * 17 / 20);
+
+  // payloads are exactly as large as asked for, and compare by key
+  static_assert(sizeof(payload<64>) == 64, "payload is padded");
+  static_assert(sizeof(payload<1024>) == 1024, "payload is padded");
+  const payload<64> p1(1), p2(2);
+  ASSERT(p1.key() == 1);
+  ASSERT(p1 == payload<64>(1));
+  ASSERT(!(p1 == p2) && p1 < p2);
+  linked_list<payload<64>, typename ll_policy<payload<64>>::lock_free> l;
+  for (uint64_t k = 0; k < 10; k++)
+    l.push_back(payload<64>(k));
+  l.remove(payload<64>(5));
+  ASSERT(l.size() == 9);
+  ASSERT(l.front().key() == 0 && l.back().key() == 9);
+}
+
+static void
+memory_usage_tests()
+{
+  const memory_usage m0 = memory_usage::read();
+  ASSERT(m0.rss_bytes > 0);
+  ASSERT(m0.peak_rss_bytes > 0);
+
+  // live bytes account for a fresh allocation
+  vector<char> *v = new vector<char>(1 << 20, 'x');
+  const memory_usage m1 = memory_usage::read();
+  ASSERT(!memory_usage::has_live_bytes() ||
+         m1.live_bytes >= m0.live_bytes + (1 << 20));
+  delete v;
+
+  // the GC thread can't reclaim p while we're in the region which freed it
+  {
+    scoped_rcu_region r;
+    r.release(new int(0));
+    ASSERT(rcu::pending() >= 1);
+  }
+  // ... but it does after a couple of epochs
+  for (int i = 0; i < 100 && rcu::pending(); i++)
+    usleep(50000);
+  ASSERT(rcu::pending() == 0);
+}
+
+static void
+perf_counters_tests()
+{
+  perf_counters pc;
+  pc.start();
+  volatile uint64_t x = 0;
+  for (uint64_t i = 0; i < 10000000; i++)
+    x = x + i;
+  pc.stop();
+  // the software events are always available, through the fallbacks if need
+  // be
+  ASSERT(pc.has(perf_counters::TASK_CLOCK));
+  ASSERT(pc.has(perf_counters::CONTEXT_SWITCHES));
+  ASSERT(pc.count(perf_counters::TASK_CLOCK) > 0);
+  if (pc.has(perf_counters::INSTRUCTIONS))
+    ASSERT(pc.count(perf_counters::INSTRUCTIONS) >= 10000000);
+}
+
+static void
+steady_state_tests()
+{
+  // too short to tell
+  ASSERT(mser5_warmup(vector<double>(9, 1.0)) == 0);
+  // flat all along
+  ASSERT(mser5_warmup(vector<double>(100, 1.0)) == 0);
+
+  // ramps up over the first 20 measurements, then hovers around 100
+  vector<double> xs;
+  for (int i = 0; i < 20; i++)
+    xs.push_back(5.0 * i);
+  for (int i = 0; i < 80; i++)
+    xs.push_back(i % 2 ? 99.0 : 101.0);
+  const size_t warmup = mser5_warmup(xs);
+  ASSERT(warmup >= 15 && warmup <= 20);
+}
+
+static void
+single_writer_counter_tests()
+{
+  single_writer_counter<size_t> c;
+  ASSERT(c.get() == 0);
+  c.inc();
+  c.inc(41);
+  ASSERT(c.get() == 42);
+
+  // a reader sees the count go up, but never back down
+  static const size_t NIncs = 1000000;
+  single_writer_counter<size_t> n;
+  atomic<bool> done(false);
+  thread reader([&n, &done]() {
+    size_t last = 0;
+    while (!done.load()) {
+      const size_t v = n.get();
+      ASSERT(v >= last && v <= NIncs);
+      last = v;
+    }
+  });
+  for (size_t i = 0; i < NIncs; i++)
+    n.inc();
+  done.store(true);
+  reader.join();
+  ASSERT(n.get() == NIncs);
+}
+
+static void
+null_impl_tests()
+{
+  linked_list<int, typename ll_policy<int>::null> l;
+  l.push_back(1);
+  l.emplace_back(2);
+  ASSERT(l.empty());
+  ASSERT(l.size() == 0);
+  ASSERT(l.begin() == l.end());
+  ASSERT(!l.try_pop_front().first);
+  // a dummy, so that workloads which expect elements keep going
+  ASSERT(&l.front() == &l.back());
+  size_t n = 0;
+  l.for_each([&n](int) { n++; });
+  ASSERT(n == 0);
+  l.remove(1);
+  l.clear();
+}
+
+static void
+json_writer_tests()
+{
+  ostringstream o;
+  json_writer json(o);
+  json.begin_object();
+  json.field("name", "a \"b\"\\\n\t");
+  json.field("n", 42ul);
+  json.field("x", 0.5);
+  json.field("nan", numeric_limits<double>::quiet_NaN());
+  json.key("empty");
+  json.begin_array();
+  json.end_array();
+  json.key("list");
+  json.begin_array();
+  json.value(true);
+  json.begin_object();
+  json.field("k", -1);
+  json.end_object();
+  json.end_array();
+  json.end_object();
+  ASSERT(o.str() ==
+      "{\"name\": \"a \\\"b\\\"\\\\\\n\\u0009\", \"n\": 42, \"x\": 0.5, "
+      "\"nan\": null, \"empty\": [], \"list\": [true, {\"k\": -1}]}");
+}
+
 template <typename IterA, typename IterB>
 static void
 AssertEqualRanges(IterA begin_a, IterA end_a, IterB begin_b, IterB end_b)
@@ -79,6 +395,88 @@ AssertEqual(Iter begin, Iter end, initializer_list<typename Iter::value_type> li
   AssertEqualRanges(begin, end, list.begin(), list.end());
 }
 
+// records when the GC thread reclaims it, instead of being deleted
+struct rcu_tracked {
+  rcu_tracked() : reclaimed(false) {}
+  atomic<bool> reclaimed;
+};
+
+static void
+rcu_tracked_deleter(void *p)
+{
+  static_cast<rcu_tracked *>(p)->reclaimed.store(true);
+}
+
+static void
+rcu_reader_writer(atomic<rcu_tracked *> &shared, atomic<bool> &f,
+                  int id, int nrounds, vector<rcu_tracked *> &allocated,
+                  atomic<int> &nreclaimed_early)
+{
+  while (!f.load())
+    nop_pause();
+  for (int i = 0; i < nrounds; i++) {
+    {
+      scoped_rcu_region r;
+      rcu_tracked *const p = shared.load();
+      usleep(500 + (i * 7919 + id * 104729) % 5000);
+      rcu_tracked *const n = new rcu_tracked;
+      allocated.push_back(n);
+      rcu::free_with_fn(shared.exchange(n), rcu_tracked_deleter);
+      usleep(10000);
+      if (p->reclaimed.load())
+        ++nreclaimed_early;
+    }
+    // leaves the GC thread room to pass our sync while the others are still
+    // in their regions
+    usleep(3000);
+  }
+}
+
+static void
+rcu_tests()
+{
+  // a thread can enter a region after the GC thread has waited for it, and
+  // read an object which another thread (still in a region from the previous
+  // epoch) unlinks afterwards. that object must outlive the first region
+  const int NThreads = 4;
+  const int NRounds = 200;
+  rcu_tracked *const first = new rcu_tracked;
+  atomic<rcu_tracked *> shared(first);
+  atomic<bool> start_flag(false);
+  atomic<int> nreclaimed_early(0);
+  vector<vector<rcu_tracked *>> allocated(NThreads);
+  vector<thread> thds;
+  for (int i = 0; i < NThreads; i++) {
+    thread t(rcu_reader_writer, ref(shared), ref(start_flag), i, NRounds,
+             ref(allocated[i]), ref(nreclaimed_early));
+    thds.push_back(move(t));
+  }
+  start_flag.store(true);
+  for (auto &t : thds)
+    t.join();
+  ASSERT(nreclaimed_early.load() == 0);
+
+  // everything but the last object is eventually reclaimed
+  vector<rcu_tracked *> retired(1, first);
+  for (auto &a : allocated)
+    for (auto p : a)
+      if (p != shared.load())
+        retired.push_back(p);
+  auto all_reclaimed = [&retired]() {
+    for (auto p : retired)
+      if (!p->reclaimed.load())
+        return false;
+    return true;
+  };
+  for (int i = 0; i < 100 && !all_reclaimed(); i++)
+    usleep(50000);
+  ASSERT(all_reclaimed());
+  ASSERT(!shared.load()->reclaimed.load());
+  for (auto p : retired)
+    delete p;
+  delete shared.load();
+}
+
 template <typename Impl>
 static void
 single_threaded_tests()
@@ -92,6 +490,7 @@ single_threaded_tests()
   ASSERT(l.front() == 1);
   ASSERT(l.back() == 1);
   ASSERT(l.size() == 1);
+  ASSERT(!l.empty());
   AssertEqual(l.begin(), l.end(), {1});
 
   l.push_back(2);
@@ -109,6 +508,15 @@ single_threaded_tests()
   l.pop_front();
   ASSERT(l.empty());
 
+  // a queue emptied by a pop keeps the popped node around as its dummy (in
+  // two_lock_queue), so make sure back() tracks the next push past it
+  l.push_back(3);
+  ASSERT(l.front() == 3);
+  ASSERT(l.back() == 3);
+  ASSERT(l.size() == 1);
+  l.pop_front();
+  ASSERT(l.empty());
+
   l.push_back(10);
   l.push_back(10);
   l.push_back(20);
@@ -119,6 +527,9 @@ single_threaded_tests()
   ASSERT(l.back() == 10);
   ASSERT(l.size() == 6);
   AssertEqual(l.begin(), l.end(), {10, 10, 20, 30, 50, 10});
+  vector<int> visited;
+  l.for_each([&visited](int v) { visited.push_back(v); });
+  AssertEqual(visited.begin(), visited.end(), {10, 10, 20, 30, 50, 10});
 
   l.remove(10);
   for (typename llist::iterator it = l.begin(); it != l.end(); ++it) {
@@ -135,6 +546,99 @@ single_threaded_tests()
   ASSERT(l.front() == 30);
   ASSERT(l.back() == 50);
   ASSERT(l.size() == 2);
+
+  for (int i = 0; i < 10; i++)
+    l.push_back(i);
+  l.remove_if([](int v) { return v % 2 == 0; });
+  ASSERT(l.front() == 1);
+  ASSERT(l.back() == 9);
+  AssertEqual(l.begin(), l.end(), {1, 3, 5, 7, 9});
+
+  const vector<int> to_remove = {1, 5, 9, 11};
+  l.remove_all(to_remove.begin(), to_remove.end());
+  ASSERT(l.front() == 3);
+  ASSERT(l.back() == 7);
+  AssertEqual(l.begin(), l.end(), {3, 7});
+
+  l.remove_if([](int) { return true; });
+  ASSERT(l.empty());
+  l.push_back(1);
+  ASSERT(l.front() == 1);
+  ASSERT(l.back() == 1);
+  ASSERT(l.size() == 1);
+}
+
+// counts copies, so we can check that values are moved through the list
+class copy_counted {
+public:
+  static size_t ncopies;
+
+  copy_counted() : value_(0) {}
+  explicit copy_counted(int value) : value_(value) {}
+
+  copy_counted(const copy_counted &that) : value_(that.value_) { ncopies++; }
+  copy_counted(copy_counted &&that) : value_(that.value_) { that.value_ = -1; }
+
+  copy_counted &
+  operator=(const copy_counted &that)
+  {
+    value_ = that.value_;
+    ncopies++;
+    return *this;
+  }
+
+  copy_counted &
+  operator=(copy_counted &&that)
+  {
+    value_ = that.value_;
+    that.value_ = -1;
+    return *this;
+  }
+
+  bool
+  operator==(const copy_counted &that) const
+  {
+    return value_ == that.value_;
+  }
+
+  int value_;
+};
+
+size_t copy_counted::ncopies = 0;
+
+// NPopCopies is the number of copies try_pop_front() makes
+template <typename Impl, size_t NPopCopies = 0>
+static void
+move_semantics_tests()
+{
+  typedef linked_list<copy_counted, Impl> llist;
+
+  copy_counted::ncopies = 0;
+  {
+    llist l;
+    l.emplace_back(1);
+    l.push_back(copy_counted(2));
+    copy_counted c(3);
+    l.push_back(move(c));
+    ASSERT(copy_counted::ncopies == 0);
+    ASSERT(l.front().value_ == 1);
+    ASSERT(l.back().value_ == 3);
+
+    auto ret = l.try_pop_front();
+    ASSERT(ret.first);
+    ASSERT(ret.second.value_ == 1);
+    ASSERT(copy_counted::ncopies == NPopCopies);
+
+    const copy_counted d(4);
+    l.push_back(d);
+    ASSERT(copy_counted::ncopies == NPopCopies + 1);
+    ASSERT(l.back().value_ == 4);
+    ASSERT(l.size() == 3);
+
+    l.clear();
+    ASSERT(l.empty());
+    ASSERT(copy_counted::ncopies == NPopCopies + 1);
+  }
 }
 
 // there's probably a better way to do this
@@ -149,6 +653,30 @@ range(int range_begin, int range_end)
   return r;
 }
 
+template <typename Impl>
+static void
+raw_iterator_tests()
+{
+  typedef linked_list<int, Impl> llist;
+
+  llist l;
+  for (auto e : range(0, 100))
+    l.push_back(e);
+  l.pop_front();
+  l.remove(50);
+  vector<int> expected = range(1, 100);
+  expected.erase(find(expected.begin(), expected.end(), 50));
+  {
+    typename Impl::read_region region UNUSED;
+    AssertEqualRanges(l.raw_begin(), l.raw_end(), expected.begin(), expected.end());
+  }
+  l.clear();
+  {
+    typename Impl::read_region region UNUSED;
+    ASSERT(l.raw_begin() == l.raw_end());
+  }
+}
+
 template <typename Impl>
 static void
 llist_insert(linked_list<int, Impl> &l, atomic<bool> &f, int range_begin, int range_end)
@@ -166,8 +694,11 @@ llist_pop_front(linked_list<int, Impl> &l, atomic<bool> &f, atomic<bool> &can_st
   while (!f.load())
     nop_pause();
   for (;;) {
+    // can_stop must be read *before* the pop: otherwise we could observe an
+    // empty list, get preempted while the pushers finish, and then stop early
+    const bool stop = can_stop.load();
     auto ret = l.try_pop_front();
-    if (!ret.first && can_stop.load())
+    if (!ret.first && stop)
       break;
     if (ret.first)
       popped.push_back(ret.second);
@@ -184,6 +715,16 @@ llist_remove(linked_list<int, Impl> &l, atomic<bool> &f, int range_begin, int ra
     l.remove(i);
 }
 
+template <typename Impl>
+static void
+llist_remove_all(linked_list<int, Impl> &l, atomic<bool> &f, int range_begin, int range_end)
+{
+  const vector<int> values = range(range_begin, range_end);
+  while (!f.load())
+    nop_pause();
+  l.remove_all(values.begin(), values.end());
+}
+
 template <typename Impl>
 static void
 llist_push_back(linked_list<int, Impl> &l, atomic<bool> &f, int range_begin, int range_end)
@@ -215,6 +756,7 @@ multi_threaded_tests()
     start_flag.store(true);
     for (auto &t : thds)
       t.join();
+    ASSERT(l.size() == (size_t) (NThreads * NElemsPerThread));
     vector<int> ll_elems(l.begin(), l.end());
     sort(ll_elems.begin(), ll_elems.end());
     ASSERT(ll_elems == range(0, NThreads * NElemsPerThread));
@@ -240,6 +782,7 @@ multi_threaded_tests()
     for (auto &t : thds)
       t.join();
     ASSERT(l.empty());
+    ASSERT(l.size() == 0);
     vector<int> ll_elems;
     for (auto &r : results)
       ll_elems.insert(ll_elems.end(), r.begin(), r.end());
@@ -266,6 +809,30 @@ multi_threaded_tests()
     for (auto &t : thds)
       t.join();
     ASSERT(l.empty());
+    ASSERT(l.size() == 0);
+  }
+
+  // same as above, but w/ every thread removing its range in a single pass
+  {
+    llist l;
+    const int NElemsPerThread = 2000;
+    const int NThreads = 4;
+    for (auto e : range(0, NThreads * NElemsPerThread))
+      l.push_back(e);
+    vector<thread> thds;
+    atomic<bool> start_flag(false);
+    for (int i = 0; i < NThreads; i++) {
+      thread t(llist_remove_all<Impl>, ref(l), ref(start_flag), i * NElemsPerThread, (i + 1) * NElemsPerThread);
+      thds.push_back(move(t));
+    }
+    start_flag.store(true);
+    for (auto &t : thds)
+      t.join();
+    ASSERT(l.empty());
+    ASSERT(l.size() == 0);
+    l.push_back(1);
+    ASSERT(l.back() == 1);
+    ASSERT(l.size() == 1);
   }
 
   // try non conflicting remove/push_backs, make sure we don't lose any of the
@@ -293,11 +860,72 @@ multi_threaded_tests()
     start_flag.store(true);
     for (auto &t : thds)
       t.join();
+    ASSERT(l.size() == (size_t) (NPushBackThreads * NElemsPerThread));
     vector<int> ll_elems(l.begin(), l.end());
     sort(ll_elems.begin(), ll_elems.end());
     ASSERT(ll_elems == range(Base, Base + (NPushBackThreads * NElemsPerThread)));
   }
 
+  // try removes and bulk removes concurrently w/ pushes and pops, make sure
+  // every pushed element is popped exactly once, and the list ends up empty
+  // (w/ its tail intact). a lost race between a remove and a pop is rare, so
+  // try a few rounds
+  for (int round = 0; round < 20; round++) {
+    llist l;
+    const int NElemsPerThread = 2000;
+    const int NRemoveThreads = 2;
+    const int NRemoveAllThreads = 2;
+    const int NPushBackThreads = 2;
+    const int NPopFrontThreads = 2;
+    const int Base = (NRemoveThreads + NRemoveAllThreads) * NElemsPerThread;
+    const int End = Base + NPushBackThreads * NElemsPerThread;
+    for (auto e : range(0, Base))
+      l.push_back(e);
+    vector<thread> thds;
+    atomic<bool> start_flag(false);
+    for (int i = 0; i < NRemoveThreads; i++) {
+      thread t(llist_remove<Impl>, ref(l), ref(start_flag), i * NElemsPerThread, (i + 1) * NElemsPerThread);
+      thds.push_back(move(t));
+    }
+    for (int i = NRemoveThreads; i < NRemoveThreads + NRemoveAllThreads; i++) {
+      thread t(llist_remove_all<Impl>, ref(l), ref(start_flag), i * NElemsPerThread, (i + 1) * NElemsPerThread);
+      thds.push_back(move(t));
+    }
+    for (int i = 0; i < NPushBackThreads; i++) {
+      thread t(llist_push_back<Impl>, ref(l), ref(start_flag),
+          Base + i * NElemsPerThread, Base + (i + 1) * NElemsPerThread);
+      thds.push_back(move(t));
+    }
+    vector<vector<int>> results(NPopFrontThreads);
+    atomic<bool> can_stop(false);
+    vector<thread> poppers;
+    for (int i = 0; i < NPopFrontThreads; i++) {
+      thread t(llist_pop_front<Impl>, ref(l), ref(start_flag), ref(can_stop), ref(results[i]));
+      poppers.push_back(move(t));
+    }
+    start_flag.store(true);
+    for (auto &t : thds)
+      t.join();
+    can_stop.store(true);
+    for (auto &t : poppers)
+      t.join();
+    ASSERT(l.empty());
+    ASSERT(l.size() == 0);
+    vector<int> popped;
+    for (auto &r : results)
+      popped.insert(popped.end(), r.begin(), r.end());
+    sort(popped.begin(), popped.end());
+    ASSERT(adjacent_find(popped.begin(), popped.end()) == popped.end());
+    // the initial elements were either popped or removed
+    const vector<int> pushed(lower_bound(popped.begin(), popped.end(), Base),
+                             popped.end());
+    ASSERT(pushed == range(Base, End));
+    l.push_back(1);
+    ASSERT(l.front() == 1);
+    ASSERT(l.back() == 1);
+    ASSERT(l.size() == 1);
+  }
+
   // try as a producer/consumer queue
   {
     llist l;
@@ -307,10 +935,15 @@ multi_threaded_tests()
     atomic<bool> can_stop(false);
     thread popper(llist_pop_front<Impl>, ref(l), ref(start_flag), ref(can_stop), ref(popped));
     start_flag.store(true);
+    // a pop can be counted before the push it undoes, which size() must not
+    // let wrap around
+    for (int i = 0; i < 1000; i++)
+      ASSERT(l.size() <= 10000);
     pusher.join();
     can_stop.store(true);
     popper.join();
     ASSERT(popped == range(0, 10000));
+    ASSERT(l.size() == 0);
   }
 }
 
@@ -326,15 +959,65 @@ int
 main(int argc, char **argv)
 {
   ExecTest(atomic_ref_ptr_tests, "atomic_ref_ptr");
+  ExecTest(rcu_tests, "rcu");
+  ExecTest(topology_tests, "topology");
+  ExecTest(histogram_tests, "histogram");
+  ExecTest(timer_tests, "timer");
+  ExecTest(workload_tests, "workload");
+  ExecTest(memory_usage_tests, "memory_usage");
+  ExecTest(perf_counters_tests, "perf_counters");
+  ExecTest(steady_state_tests, "steady_state");
+  ExecTest(json_writer_tests, "json_writer");
+  ExecTest(single_writer_counter_tests, "single_writer_counter");
+  ExecTest(null_impl_tests, "null_impl");
+
+  ExecTest(lock_tests<tas_spinlock>, "lock tas_spinlock");
+  ExecTest(lock_tests<ttas_spinlock<>>, "lock ttas_spinlock");
+  ExecTest(lock_tests<ttas_spinlock<exponential_backoff<>>>, "lock ttas_spinlock w/ exponential backoff");
+  ExecTest(lock_tests<ttas_spinlock<proportional_backoff<>>>, "lock ttas_spinlock w/ proportional backoff");
+  ExecTest(lock_tests<mcs_lock, 10000>, "lock mcs_lock");
+  ExecTest(lock_tests<clh_lock, 10000>, "lock clh_lock");
+  ExecTest(lock_tests<hybrid_lock<>>, "lock hybrid_lock");
+  ExecTest(lock_tests<cohort_lock<>, 10000>, "lock cohort_lock");
+  ExecTest(lock_tests<cohort_lock<1>, 10000>, "lock cohort_lock w/ 1 pass");
 
   ExecTest(single_threaded_tests<typename ll_policy<int>::global_lock>, "single-threaded global_lock");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::global_rwlock>, "single-threaded global_rwlock");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::global_seqlock>, "single-threaded global_seqlock");
   ExecTest(single_threaded_tests<typename ll_policy<int>::per_node_lock>, "single-threaded per_node_locks");
   ExecTest(single_threaded_tests<typename ll_policy<int>::lock_free>, "single-threaded lock_free");
   ExecTest(single_threaded_tests<typename ll_policy<int>::lock_free_rcu>, "single-threaded lock_free_rcu");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::lazy>, "single-threaded lazy");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::two_lock_queue>, "single-threaded two_lock_queue");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::with_lock<mcs_lock>::global_lock>, "single-threaded global_lock w/ mcs_lock");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::with_lock<clh_lock>::per_node_lock>, "single-threaded per_node_locks w/ clh_lock");
+  ExecTest(single_threaded_tests<typename ll_policy<int>::with_lock<cohort_lock<>>::global_lock>, "single-threaded global_lock w/ cohort_lock");
+
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::global_lock>, "move-semantics global_lock");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::global_rwlock>, "move-semantics global_rwlock");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::global_seqlock>, "move-semantics global_seqlock");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::per_node_lock>, "move-semantics per_node_locks");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::lock_free, 1>, "move-semantics lock_free");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::lock_free_rcu, 1>, "move-semantics lock_free_rcu");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::lazy, 1>, "move-semantics lazy");
+  ExecTest(move_semantics_tests<typename ll_policy<copy_counted>::two_lock_queue>, "move-semantics two_lock_queue");
+
+  ExecTest(raw_iterator_tests<typename ll_policy<int>::lock_free_rcu>, "raw-iterator lock_free_rcu");
+  ExecTest(raw_iterator_tests<typename ll_policy<int>::lazy>, "raw-iterator lazy");
 
   ExecTest(multi_threaded_tests<typename ll_policy<int>::global_lock>, "multi-threaded global_lock");
+  ExecTest(multi_threaded_tests<typename ll_policy<int>::global_rwlock>, "multi-threaded global_rwlock");
+  ExecTest(multi_threaded_tests<typename ll_policy<int>::global_seqlock>, "multi-threaded global_seqlock");
   ExecTest(multi_threaded_tests<typename ll_policy<int>::per_node_lock>, "multi-threaded per_node_locks");
   ExecTest(multi_threaded_tests<typename ll_policy<int>::lock_free>, "multi-threaded lock_free");
   ExecTest(multi_threaded_tests<typename ll_policy<int>::lock_free_rcu>, "multi-threaded lock_free_rcu");
+  ExecTest(multi_threaded_tests<typename ll_policy<int>::lazy>, "multi-threaded lazy");
+  ExecTest(multi_threaded_tests<typename ll_policy<int>::two_lock_queue>, "multi-threaded two_lock_queue");
+  ExecTest(multi_threaded_tests<typename ll_policy<int>::with_lock<hybrid_lock<>>::global_lock>, "multi-threaded global_lock w/ hybrid_lock");
+
+  typedef typename ll_policy<int>::with_backoff<adaptive_backoff<>> adaptive_policy;
+  typedef typename ll_policy<int>::with_backoff<randomized_backoff<>> randomized_policy;
+  ExecTest(single_threaded_tests<typename adaptive_policy::lock_free>, "single-threaded lock_free w/ adaptive backoff");
+  ExecTest(multi_threaded_tests<typename randomized_policy::lock_free_rcu>, "multi-threaded lock_free_rcu w/ randomized backoff");
   return 0;
 }
@@ -0,0 +1,40 @@
+#include <cpuid.h>
+#include <unistd.h>
+
+#include "timer.hpp"
+
+// how long the TSC is calibrated against CLOCK_MONOTONIC for
+static const uint64_t calibration_usec = 10 * 1000;
+
+tsc_clock::calibration::calibration()
+  : use_tsc_(invariant_tsc()), nsec_per_tick_(1.0)
+{
+  if (!use_tsc_)
+    return;
+  const uint64_t ns0 = monotonic_nsec();
+  const uint64_t tsc0 = rdtscp();
+  usleep(calibration_usec);
+  const uint64_t ns1 = monotonic_nsec();
+  const uint64_t tsc1 = rdtscp();
+  if (tsc1 <= tsc0 || ns1 <= ns0) {
+    // a broken TSC, or a broken clock. stick w/ the clock
+    use_tsc_ = false;
+    return;
+  }
+  nsec_per_tick_ = double(ns1 - ns0) / double(tsc1 - tsc0);
+}
+
+bool
+tsc_clock::invariant_tsc()
+{
+  unsigned int eax, ebx, ecx, edx;
+  // rdtscp is reported in 0x80000001:EDX[27], invariant TSC in
+  // 0x80000007:EDX[8]
+  if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+    return false;
+  if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 27)))
+    return false;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return false;
+  return edx & (1 << 8);
+}
@@ -1,13 +1,83 @@
 #pragma once
 
 #include <cstdint>
-#include <sys/time.h>
+#include <ctime>
 
+#include "asm.hpp"
+#include "macros.hpp"
+
+// nanoseconds since an arbitrary, fixed point in time
+static inline uint64_t
+monotonic_nsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * High resolution clock, for timing intervals down to tens of ns.
+ *
+ * Reads the TSC when it is invariant (constant rate, and ticking through
+ * sleep states), which costs a few ns and no syscall. The TSC rate is
+ * calibrated against CLOCK_MONOTONIC upon first use (which takes ~10ms). If
+ * the TSC is not invariant, ticks are CLOCK_MONOTONIC nanoseconds instead.
+ *
+ * ticks() reads the clock w/ rdtscp, which waits for all prior instructions
+ * to execute, so that the end of a timed interval isn't read early. Intervals
+ * are computed in ticks, and converted w/ to_nsec() when needed.
+ */
+class tsc_clock {
+public:
+  static inline uint64_t
+  ticks()
+  {
+    return likely(get().use_tsc_) ? rdtscp() : monotonic_nsec();
+  }
+
+  static inline double
+  to_nsec(uint64_t ticks)
+  {
+    return ticks * get().nsec_per_tick_;
+  }
+
+  // whether ticks are TSC cycles (or else nanoseconds)
+  static inline bool
+  uses_tsc()
+  {
+    return get().use_tsc_;
+  }
+
+  // TSC cycles per nanosecond (ie GHz), or 1 if the TSC isn't used
+  static inline double
+  ticks_per_nsec()
+  {
+    return 1.0 / get().nsec_per_tick_;
+  }
+
+private:
+  struct calibration {
+    calibration();
+    bool use_tsc_;
+    double nsec_per_tick_;
+  };
+
+  static inline const calibration &
+  get()
+  {
+    static const calibration c;
+    return c;
+  }
+
+  static bool invariant_tsc();
+};
+
+// measures the time between laps, in microseconds or nanoseconds
 class timer {
 public:
   inline timer()
   {
-    lap();
+    lap_nsec();
   }
 
   timer(const timer &) = delete;
@@ -16,20 +86,18 @@ public:
   inline uint64_t
   lap()
   {
-    const uint64_t t0 = start;
-    const uint64_t t1 = cur_usec();
-    start = t1;
-    return t1 - t0;
+    return lap_nsec() / 1000;
   }
 
-private:
-  static inline uint64_t
-  cur_usec()
+  inline uint64_t
+  lap_nsec()
   {
-    struct timeval tv;
-    gettimeofday(&tv, 0);
-    return ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+    const uint64_t t0 = start;
+    const uint64_t t1 = tsc_clock::ticks();
+    start = t1;
+    return tsc_clock::to_nsec(t1 - t0);
   }
 
+private:
   uint64_t start;
 };
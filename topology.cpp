@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "topology.hpp"
+#include "macros.hpp"
+
+using namespace std;
+
+size_t
+topology::num_nodes()
+{
+  return get().node_cpus.size();
+}
+
+size_t
+topology::num_cpus()
+{
+  return get().cpu_node.size();
+}
+
+unsigned int
+topology::node_of_cpu(unsigned int cpu)
+{
+  const layout &l = get();
+  return cpu < l.cpu_node.size() ? l.cpu_node[cpu] : 0;
+}
+
+const vector<unsigned int> &
+topology::cpus_of_node(unsigned int node)
+{
+  return get().node_cpus.at(node);
+}
+
+unsigned int
+topology::current_node()
+{
+  const int cpu = sched_getcpu();
+  return cpu >= 0 ? node_of_cpu(cpu) : 0;
+}
+
+vector<unsigned int>
+topology::parse_cpulist(const string &s)
+{
+  vector<unsigned int> ret;
+  istringstream in(s);
+  string range;
+  while (getline(in, range, ',')) {
+    if (range.empty() || range == "\n")
+      continue;
+    const char *p = range.c_str();
+    char *end = nullptr;
+    const unsigned long lo = strtoul(p, &end, 10);
+    if (end == p)
+      continue;
+    unsigned long hi = lo;
+    if (*end == '-')
+      hi = strtoul(end + 1, nullptr, 10);
+    for (unsigned long cpu = lo; cpu <= hi; cpu++)
+      ret.push_back(cpu);
+  }
+  return ret;
+}
+
+vector<unsigned int>
+topology::compact_order()
+{
+  vector<unsigned int> ret;
+  for (auto &cpus : get().node_cpus)
+    ret.insert(ret.end(), cpus.begin(), cpus.end());
+  return ret;
+}
+
+vector<unsigned int>
+topology::scatter_order()
+{
+  const layout &l = get();
+  vector<unsigned int> ret;
+  for (size_t i = 0; ret.size() < l.cpu_node.size(); i++) {
+    const size_t n = ret.size();
+    for (auto &cpus : l.node_cpus)
+      if (i < cpus.size())
+        ret.push_back(cpus[i]);
+    if (ret.size() == n)
+      break; // cpu_node has gaps (offline CPUs)
+  }
+  return ret;
+}
+
+bool
+topology::pin(pthread_t t, unsigned int cpu)
+{
+  if (cpu >= CPU_SETSIZE)
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return !pthread_setaffinity_np(t, sizeof(set), &set);
+}
+
+const topology::layout &
+topology::get()
+{
+  // initialized once, thread-safely (C++11)
+  static const layout l = []() {
+    layout l;
+    if (!read_sysfs(l))
+      single_node(l);
+    return l;
+  }();
+  return l;
+}
+
+bool
+topology::read_sysfs(layout &l)
+{
+  static const string root = "/sys/devices/system/node";
+  DIR *d = opendir(root.c_str());
+  if (!d)
+    return false;
+  // node ids can have gaps, which become empty nodes
+  while (struct dirent *e = readdir(d)) {
+    unsigned int node;
+    char trailing;
+    if (sscanf(e->d_name, "node%u%c", &node, &trailing) != 1)
+      continue;
+    ifstream f(root + "/" + e->d_name + "/cpulist");
+    string cpulist;
+    if (!getline(f, cpulist))
+      continue;
+    if (node >= l.node_cpus.size())
+      l.node_cpus.resize(node + 1);
+    l.node_cpus[node] = parse_cpulist(cpulist);
+  }
+  closedir(d);
+
+  for (size_t node = 0; node < l.node_cpus.size(); node++)
+    for (unsigned int cpu : l.node_cpus[node]) {
+      if (cpu >= l.cpu_node.size())
+        l.cpu_node.resize(cpu + 1, 0);
+      l.cpu_node[cpu] = node;
+    }
+  return !l.cpu_node.empty();
+}
+
+void
+topology::single_node(layout &l)
+{
+  const long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  l.node_cpus.assign(1, vector<unsigned int>());
+  l.cpu_node.assign(ncpus > 0 ? ncpus : 1, 0);
+  for (size_t cpu = 0; cpu < l.cpu_node.size(); cpu++)
+    l.node_cpus[0].push_back(cpu);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+/**
+ * The machine's NUMA layout, as reported by /sys/devices/system/node. It is
+ * read once, upon first use. If sysfs is unavailable (or reports no nodes),
+ * every online CPU is placed in a single node 0.
+ */
+class topology {
+public:
+  static size_t num_nodes();
+  static size_t num_cpus();
+
+  // CPUs are numbered as the kernel does. node_of_cpu() maps CPUs which it
+  // doesn't know about (eg ones brought online later) to node 0
+  static unsigned int node_of_cpu(unsigned int cpu);
+  static const std::vector<unsigned int> &cpus_of_node(unsigned int node);
+
+  // the node of the CPU the calling thread is running on. the thread can
+  // migrate right after, so callers can only use this as a hint
+  static unsigned int current_node();
+
+  // parses a kernel cpulist, eg "0-3,8,10-11"
+  static std::vector<unsigned int> parse_cpulist(const std::string &s);
+
+  // every CPU, in the order threads should be placed on them:
+  //   compact: fills up a node before moving on to the next one
+  //   scatter: round-robin across nodes
+  static std::vector<unsigned int> compact_order();
+  static std::vector<unsigned int> scatter_order();
+
+  // restricts thread t to run on cpu only. returns false on failure (eg if
+  // cpu doesn't exist, or the process isn't allowed to run on it)
+  static bool pin(pthread_t t, unsigned int cpu);
+
+private:
+  struct layout {
+    std::vector<std::vector<unsigned int>> node_cpus;
+    std::vector<unsigned int> cpu_node;
+  };
+
+  static const layout &get();
+  static bool read_sysfs(layout &l);
+  static void single_node(layout &l);
+};
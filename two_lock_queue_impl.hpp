@@ -0,0 +1,322 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "macros.hpp"
+#include "spinlock.hpp"
+#include "lock_profile.hpp"
+#include "util.hpp"
+
+/**
+ * Two-lock queue, in the style of Michael and Scott's two-lock concurrent
+ * queue: push_back() only takes the tail lock, and pop_front()/try_pop_front()
+ * only take the head lock, so producers and consumers never contend w/ each
+ * other. A dummy node at the front of the list keeps the two ends apart even
+ * when the queue is empty.
+ *
+ * When a consumer pops the first element, the node holding it becomes the new
+ * dummy node (after its value is moved out), and the old dummy is freed.
+ *
+ * size() is O(1), and approximate while mutations are in flight: producers
+ * and consumers count elements in sharded counters, rather than contending on
+ * a single one. empty() only takes the head lock. All other operations take
+ * both locks (head first), so they are correct but serialize everything- this
+ * policy is meant for queue workloads.
+ *
+ * References returned by this implementation are guaranteed to be valid until
+ * the element is removed from the list
+ */
+namespace private_ {
+  LOCK_SITE(two_lock_queue_head_site, "two_lock_queue_impl::head_mutex_");
+  LOCK_SITE(two_lock_queue_tail_site, "two_lock_queue_impl::tail_mutex_");
+}
+
+template <typename T, typename LockImpl = spinlock>
+class two_lock_queue_impl {
+private:
+
+  typedef site_lock<LockImpl, private_::two_lock_queue_head_site>
+    head_lock_type;
+  typedef site_lock<LockImpl, private_::two_lock_queue_tail_site>
+    tail_lock_type;
+
+  struct node {
+    // non-copyable
+    node(const node &) = delete;
+    node(node &&) = delete;
+    node &operator=(const node &) = delete;
+
+    node() : value_(), next_() {}
+
+    // value_ is constructed in place from args
+    template <typename... Args>
+    explicit node(node *next, Args &&... args)
+      : value_(std::forward<Args>(args)...), next_(next) {}
+
+    T value_;
+
+    // the dummy node's next_ is written by producers (when the queue is
+    // empty) and read by consumers concurrently
+    std::atomic<node *> next_;
+
+    inline node *
+    next() const
+    {
+      return next_.load(std::memory_order_acquire);
+    }
+  };
+
+  // both locks, head first
+  struct full_lock {
+    full_lock(head_lock_type &head_mutex, tail_lock_type &tail_mutex)
+      : head_l_(head_mutex), tail_l_(tail_mutex) {}
+    std::unique_lock<head_lock_type> head_l_;
+    std::unique_lock<tail_lock_type> tail_l_;
+  };
+  typedef std::shared_ptr<full_lock> full_lock_ptr;
+
+  // head_mutex_ guards head_, and tail_mutex_ guards tail_. they are padded
+  // apart, so that producers and consumers don't false share (padding
+  // instead of alignment, since lists are allocated w/ plain new)
+  mutable head_lock_type head_mutex_;
+  node *head_; // head_ points to the dummy node
+  char pad_[CACHELINE_SIZE];
+  mutable tail_lock_type tail_mutex_;
+  node *tail_;
+
+  // +1 for every push, -1 for every pop, after the fact
+  sharded_counters<int64_t> size_;
+
+  struct iterator_ : public std::iterator<std::forward_iterator_tag, T> {
+    iterator_() : lock_(), node_() {}
+    iterator_(full_lock_ptr &&lock, node *node)
+      : lock_(std::move(lock)), node_(node) {}
+
+    T &
+    operator*() const
+    {
+      return node_->value_;
+    }
+
+    T *
+    operator->() const
+    {
+      return &node_->value_;
+    }
+
+    bool
+    operator==(const iterator_ &o) const
+    {
+      return node_ == o.node_;
+    }
+
+    bool
+    operator!=(const iterator_ &o) const
+    {
+      return !operator==(o);
+    }
+
+    iterator_ &
+    operator++()
+    {
+      node_ = node_->next();
+      return *this;
+    }
+
+    iterator_
+    operator++(int)
+    {
+      iterator_ cur = *this;
+      ++(*this);
+      return cur;
+    }
+
+    full_lock_ptr lock_;
+    node *node_;
+  };
+
+public:
+
+  typedef iterator_ iterator;
+
+  two_lock_queue_impl()
+    : head_mutex_(), head_(new node), pad_(), tail_mutex_(), tail_(head_),
+      size_() {}
+
+  ~two_lock_queue_impl()
+  {
+    // can do this non-thread safe, since we know there are no other users
+    node *cur = head_;
+    while (cur) {
+      node *next = cur->next();
+      delete cur;
+      cur = next;
+    }
+  }
+
+  inline size_t
+  size() const
+  {
+    // a pop can be counted before the push it undoes
+    const int64_t n = size_.sum(0);
+    return n > 0 ? n : 0;
+  }
+
+  inline bool
+  empty() const
+  {
+    std::unique_lock<head_lock_type> l(head_mutex_);
+    return !head_->next();
+  }
+
+  inline T &
+  front()
+  {
+    std::unique_lock<head_lock_type> l(head_mutex_);
+    node *p = head_->next();
+    assert(p);
+    return p->value_;
+  }
+
+  inline const T &
+  front() const
+  {
+    return const_cast<two_lock_queue_impl *>(this)->front();
+  }
+
+  inline T &
+  back()
+  {
+    // on an empty queue tail_ is the dummy node, whose value was moved out by
+    // the pop which made it the dummy. head_ is only stable under the head
+    // lock, so check for that before taking the tail lock
+    assert(!empty());
+    std::unique_lock<tail_lock_type> l(tail_mutex_);
+    return tail_->value_;
+  }
+
+  inline const T &
+  back() const
+  {
+    return const_cast<two_lock_queue_impl *>(this)->back();
+  }
+
+  void
+  pop_front()
+  {
+    bool ret UNUSED = pop_first([](T &) {});
+    assert(ret);
+  }
+
+  template <typename... Args>
+  void
+  emplace_back(Args &&... args)
+  {
+    // construct the value outside of the critical section
+    node *n = new node(nullptr, std::forward<Args>(args)...);
+    std::unique_lock<tail_lock_type> l(tail_mutex_);
+    tail_->next_.store(n, std::memory_order_release);
+    tail_ = n;
+    l.unlock();
+    size_.add(0, 1);
+  }
+
+  inline void
+  remove(const T &val)
+  {
+    remove_if([&val](const T &v) { return v == val; });
+  }
+
+  template <typename Predicate>
+  void
+  remove_if(Predicate pred)
+  {
+    // unlinked nodes are freed once the locks are released
+    std::vector<node *> unlinked;
+    {
+      full_lock l(head_mutex_, tail_mutex_);
+      node *prev = head_;
+      node *p = prev->next();
+      while (p) {
+        node *next = p->next();
+        if (pred(p->value_)) {
+          prev->next_.store(next, std::memory_order_relaxed);
+          if (p == tail_)
+            tail_ = prev;
+          unlinked.push_back(p);
+        } else {
+          prev = p;
+        }
+        p = next;
+      }
+    }
+    for (auto p : unlinked)
+      delete p;
+    if (!unlinked.empty())
+      size_.add(0, -int64_t(unlinked.size()));
+  }
+
+  std::pair<bool, T>
+  try_pop_front()
+  {
+    T t;
+    if (!pop_first([&t](T &v) { t = std::move(v); }))
+      return std::make_pair(false, T());
+    return std::make_pair(true, std::move(t));
+  }
+
+  // Invokes fn on every element, under both locks. fn must not call back into
+  // the list.
+  template <typename Function>
+  void
+  for_each(Function fn)
+  {
+    full_lock l(head_mutex_, tail_mutex_);
+    for (node *p = head_->next(); p; p = p->next())
+      fn(p->value_);
+  }
+
+  iterator
+  begin()
+  {
+    full_lock_ptr l(std::make_shared<full_lock>(head_mutex_, tail_mutex_));
+    node *p = head_->next();
+    return iterator_(std::move(l), p);
+  }
+
+  iterator
+  end()
+  {
+    return iterator_();
+  }
+
+private:
+
+  // hands the first value to fn, and makes its node the new dummy node.
+  // returns false if the queue was empty
+  template <typename Function>
+  bool
+  pop_first(Function fn)
+  {
+    std::unique_lock<head_lock_type> l(head_mutex_);
+    node *dummy = head_;
+    node *first = dummy->next();
+    if (unlikely(!first))
+      return false;
+    // producers only ever touch tail_->next_, never values, so first's value
+    // can be taken while a producer appends to it
+    fn(first->value_);
+    head_ = first;
+    l.unlock();
+    // dummy can't be tail_, since first follows it
+    delete dummy;
+    size_.add(0, -1);
+    return true;
+  }
+};
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <thread>
+
 #include "macros.hpp"
 
 // padded, aligned primitives
@@ -9,3 +15,112 @@ struct aligned_padded_elem {
   T elem;
   CACHE_PADOUT;
 } CACHE_ALIGNED;
+
+// hash of the calling thread's id, computed once per thread
+inline size_t
+this_thread_hash()
+{
+  static __thread bool computed = false;
+  static __thread size_t h = 0;
+  if (unlikely(!computed)) {
+    h = std::hash<std::thread::id>()(std::this_thread::get_id());
+    computed = true;
+  }
+  return h;
+}
+
+/**
+ * A counter which only a single thread updates, but any thread can read.
+ *
+ * Since there's only a single writer, an update is a plain load, add and
+ * store (all relaxed), rather than a locked read-modify-write, so it costs
+ * about as much as bumping a plain variable. Readers see some recent value,
+ * which never goes backwards.
+ */
+template <typename T>
+class single_writer_counter {
+public:
+  single_writer_counter() : v_(0) {}
+
+  single_writer_counter(const single_writer_counter &) = delete;
+  single_writer_counter &operator=(const single_writer_counter &) = delete;
+
+  // only ever called by the writer
+  inline void
+  inc(T delta = 1)
+  {
+    v_.store(v_.load(std::memory_order_relaxed) + delta,
+             std::memory_order_relaxed);
+  }
+
+  inline T
+  get() const
+  {
+    return v_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<T> v_;
+};
+
+/**
+ * A fixed set of NCounters counters, sharded by thread so that frequent
+ * updates from different threads don't fight over the same cache line.
+ *
+ * Reads have to visit every shard, so they are relatively expensive, and
+ * only approximate while updates are in flight.
+ */
+template <typename T, size_t NCounters = 1, size_t NShards = 64>
+class sharded_counters {
+public:
+  // the shards live in their own cache aligned allocation, so that embedding
+  // a sharded_counters doesn't force an extended alignment onto its owner
+  sharded_counters() : shards_(nullptr)
+  {
+    void *p = nullptr;
+    if (posix_memalign(&p, CACHELINE_SIZE, sizeof(padded_shard) * NShards))
+      throw std::bad_alloc();
+    shards_ = static_cast<padded_shard *>(p);
+    for (size_t i = 0; i < NShards; i++)
+      new (&shards_[i]) padded_shard();
+  }
+
+  ~sharded_counters()
+  {
+    for (size_t i = 0; i < NShards; i++)
+      shards_[i].~padded_shard();
+    free(shards_);
+  }
+
+  sharded_counters(const sharded_counters &) = delete;
+  sharded_counters &operator=(const sharded_counters &) = delete;
+
+  inline void
+  add(size_t idx, T delta)
+  {
+    shards_[this_thread_hash() % NShards].elem.counts_[idx].fetch_add(
+        delta, std::memory_order_relaxed);
+  }
+
+  T
+  sum(size_t idx) const
+  {
+    T ret = 0;
+    for (size_t i = 0; i < NShards; i++)
+      ret += shards_[i].elem.counts_[idx].load(std::memory_order_relaxed);
+    return ret;
+  }
+
+private:
+  struct shard {
+    shard()
+    {
+      for (size_t i = 0; i < NCounters; i++)
+        counts_[i].store(0, std::memory_order_relaxed);
+    }
+    std::atomic<T> counts_[NCounters];
+  };
+
+  typedef aligned_padded_elem<shard> padded_shard;
+  padded_shard *shards_;
+};
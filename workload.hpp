@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Building blocks for synthetic workloads: a cheap RNG, distributions of keys
+ * to operate on, and values of a given size.
+ *
+ * Every worker owns its RNG (seeded explicitly, so that runs are
+ * reproducible), so drawing a key costs a few ns, and never touches shared
+ * state other than read-only tables.
+ */
+
+// xorshift64*, which is good enough for picking ops and keys
+class fast_random {
+public:
+  explicit fast_random(uint64_t seed)
+    : state_(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
+
+  inline uint64_t
+  next()
+  {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545f4914f6cdd1dULL;
+  }
+
+  // uniform in [0, 2^32)
+  inline uint32_t
+  next32()
+  {
+    return next() >> 32;
+  }
+
+  // uniform in [0, n), w/ a multiplication instead of a division
+  inline uint64_t
+  next_below(uint64_t n)
+  {
+    return uint64_t((unsigned __int128) next() * n >> 64);
+  }
+
+private:
+  uint64_t state_;
+};
+
+// Draws keys in [0, nkeys):
+//   uniform: every key is equally likely
+//   zipfian: key i w/ probability proportional to 1 / (i + 1)^theta, sampled
+//     in O(1) from an alias table (Walker/Vose), which is built once and
+//     shared by all copies of the distribution
+//   hotspot: a fraction hot_ops of the draws are uniform over the first
+//     hot_keys * nkeys keys, and the rest are uniform over the others
+class key_distribution {
+public:
+  static key_distribution
+  uniform(uint64_t nkeys)
+  {
+    key_distribution d(UNIFORM, nkeys);
+    return d;
+  }
+
+  static key_distribution
+  zipfian(uint64_t nkeys, double theta)
+  {
+    key_distribution d(ZIPFIAN, nkeys);
+    d.theta_ = theta;
+    std::vector<double> weights(nkeys);
+    for (uint64_t i = 0; i < nkeys; i++)
+      weights[i] = 1.0 / std::pow(double(i + 1), theta);
+    d.table_ = std::make_shared<const alias_table>(weights);
+    return d;
+  }
+
+  static key_distribution
+  hotspot(uint64_t nkeys, double hot_keys, double hot_ops)
+  {
+    key_distribution d(HOTSPOT, nkeys);
+    d.hot_keys_ = hot_keys;
+    d.hot_ops_ = hot_ops;
+    d.nhot_ = std::max(uint64_t(1), std::min(nkeys - 1, uint64_t(hot_keys * nkeys)));
+    d.hot_threshold_ = uint32_t(std::min(hot_ops, 1.0) * 4294967295.0);
+    return d;
+  }
+
+  inline uint64_t
+  nkeys() const
+  {
+    return nkeys_;
+  }
+
+  inline uint64_t
+  next(fast_random &r) const
+  {
+    switch (kind_) {
+    case ZIPFIAN:
+      return table_->sample(r);
+    case HOTSPOT:
+      if (r.next32() < hot_threshold_)
+        return r.next_below(nhot_);
+      return nhot_ + r.next_below(nkeys_ - nhot_);
+    case UNIFORM:
+    default:
+      return r.next_below(nkeys_);
+    }
+  }
+
+  std::string
+  describe() const
+  {
+    std::ostringstream o;
+    switch (kind_) {
+    case UNIFORM:
+      o << "uniform";
+      break;
+    case ZIPFIAN:
+      o << "zipfian (theta " << theta_ << ")";
+      break;
+    case HOTSPOT:
+      o << "hotspot (" << hot_ops_ * 100 << "% of ops on "
+        << hot_keys_ * 100 << "% of keys)";
+      break;
+    }
+    o << " over " << nkeys_ << " keys";
+    return o.str();
+  }
+
+private:
+  enum kind {
+    UNIFORM,
+    ZIPFIAN,
+    HOTSPOT,
+  };
+
+  class alias_table {
+  public:
+    explicit alias_table(const std::vector<double> &weights)
+      : threshold_(weights.size()), alias_(weights.size())
+    {
+      const size_t n = weights.size();
+      double sum = 0.0;
+      for (double w : weights)
+        sum += w;
+      // scaled so that the average bucket is 1
+      std::vector<double> p(n);
+      std::vector<uint64_t> small, large;
+      for (size_t i = 0; i < n; i++) {
+        p[i] = weights[i] * n / sum;
+        (p[i] < 1.0 ? small : large).push_back(i);
+      }
+      // every small bucket is topped off by a large one
+      while (!small.empty() && !large.empty()) {
+        const uint64_t s = small.back(), l = large.back();
+        small.pop_back();
+        large.pop_back();
+        threshold_[s] = to_threshold(p[s]);
+        alias_[s] = l;
+        p[l] -= 1.0 - p[s];
+        (p[l] < 1.0 ? small : large).push_back(l);
+      }
+      // leftovers are full, up to rounding errors
+      for (uint64_t i : small)
+        set_full(i);
+      for (uint64_t i : large)
+        set_full(i);
+    }
+
+    inline uint64_t
+    sample(fast_random &r) const
+    {
+      const uint64_t i = r.next_below(threshold_.size());
+      return r.next32() < threshold_[i] ? i : alias_[i];
+    }
+
+  private:
+    static inline uint32_t
+    to_threshold(double p)
+    {
+      return uint32_t(std::min(std::max(p, 0.0), 1.0) * 4294967295.0);
+    }
+
+    inline void
+    set_full(uint64_t i)
+    {
+      threshold_[i] = ~uint32_t(0);
+      alias_[i] = i;
+    }
+
+    // bucket i yields i if the draw is below threshold_[i], else alias_[i]
+    std::vector<uint32_t> threshold_;
+    std::vector<uint64_t> alias_;
+  };
+
+  key_distribution(kind k, uint64_t nkeys)
+    : kind_(k), nkeys_(nkeys), theta_(0.0), hot_keys_(0.0), hot_ops_(0.0),
+      nhot_(0), hot_threshold_(0) {}
+
+  kind kind_;
+  uint64_t nkeys_;
+  double theta_;
+  double hot_keys_;
+  double hot_ops_;
+  uint64_t nhot_;
+  uint32_t hot_threshold_;
+  std::shared_ptr<const alias_table> table_;
+};
+
+// A value of exactly Size bytes: a key, followed by padding which is filled
+// in from the key (so that constructing and copying a payload touches all of
+// it). Payloads compare by key only, like records looked up by their key, so
+// a traversal only reads the first cache line of every payload.
+template <size_t Size>
+struct payload {
+  static_assert(Size > sizeof(uint64_t), "payload too small for its key");
+
+  payload() : key_(0), bytes_() {}
+
+  explicit payload(uint64_t key) : key_(key)
+  {
+    memset(bytes_, int(key), sizeof(bytes_));
+  }
+
+  inline uint64_t
+  key() const
+  {
+    return key_;
+  }
+
+  inline bool
+  operator==(const payload &other) const
+  {
+    return key_ == other.key_;
+  }
+
+  inline bool
+  operator<(const payload &other) const
+  {
+    return key_ < other.key_;
+  }
+
+  uint64_t key_;
+  char bytes_[Size - sizeof(uint64_t)];
+};